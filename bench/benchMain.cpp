@@ -0,0 +1,389 @@
+﻿#include "standInServer.h"
+#include "versionBench.h"
+#include "manifestBench.h"
+#include "../src/updater.h"
+#include "../src/versionComparator.h"
+
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QThread>
+#include <QTemporaryDir>
+#include <QDir>
+#include <QEventLoop>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QTextStream>
+#include <QFile>
+#include <QtEndian>
+
+#include <QDebug>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+
+// ======================
+// 端到端更新基准测试
+// ======================
+// 在独立线程中启动本地替身服务器，每个场景在一个临时目录中跑一次完整的 Updater::process()，
+// 记录耗时、进程峰值内存、服务器请求数和发送字节数
+// 用法：updater_bench [--scenario <name>] [--installer-mb <n>] [--json <path>] [--verbose]
+// --scenario version-compare 只运行版本号比较的微基准，不启动服务器
+// --scenario manifest-parse 只运行版本信息解析的微基准（--manifest-entries 指定文件数）
+// --scenario version-properties 只运行版本号比较的性质检查（--property-samples、--property-seed）
+
+static bool verboseLog = false;
+
+static void benchMessageHandle(QtMsgType type, const QMessageLogContext&, const QString& msg)
+{
+    if (type == QtDebugMsg && !verboseLog) {
+        return;
+    }
+    fprintf(stderr, "%s\n", qPrintable(msg));
+}
+
+// 进程峰值内存（字节），是整个进程的值，包括服务器线程
+static qint64 peakMemoryBytes()
+{
+#ifdef Q_OS_WIN
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return static_cast<qint64>(counters.PeakWorkingSetSize);
+    }
+    return 0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<qint64>(usage.ru_maxrss) * 1024;
+#endif
+}
+
+struct Scenario {
+    QString name;
+    QString description;
+    // 在 start() 之前配置服务器
+    std::function<void(StandInServer&)> setup;
+    // 同一个目录连续运行的次数，第二次起用来测量“已是最新”的开销
+    int runs = 1;
+    // 额外的镜像服务器，每个各自配置，配置成 server/mirrors
+    std::vector<std::function<void(StandInServer&)>> mirrors;
+};
+
+struct RunResult {
+    bool success = false;
+    QString message;
+    qint64 wallMs = 0;
+    qint64 requests = 0;
+    qint64 bytesSent = 0;
+    qint64 failuresInjected = 0;
+};
+
+static QByteArray makeManifest(const QString& version, const QString& installerHash, int hotfix, const QJsonArray& files)
+{
+    QJsonObject manifest;
+    manifest["main_program"] = "main.exe";
+    manifest["version"] = version;
+    manifest["hash"] = installerHash;
+    manifest["hotfix"] = QString::number(hotfix);
+    manifest["files"] = files;
+    return QJsonDocument(manifest).toJson(QJsonDocument::Compact);
+}
+
+// 把已添加到服务器的合成文件按 UPDB 格式打包，格式见 hotfixBundle.h
+static QByteArray makeBundle(StandInServer& server, const QStringList& names, qint64 size)
+{
+    QByteArray index;
+    for (const QString& name : names) {
+        QByteArray utf8 = name.toUtf8();
+        char field[8];
+        qToLittleEndian<quint16>(static_cast<quint16>(utf8.size()), field);
+        index.append(field, 2);
+        index.append(utf8);
+        qToLittleEndian<quint64>(static_cast<quint64>(size), field);
+        index.append(field, 8);
+        index.append(QByteArray::fromHex(server.fileHash(name).toLatin1()));
+    }
+
+    QByteArray bundle("UPDB");
+    bundle.append(char(1));
+    char field[4];
+    qToLittleEndian<quint32>(static_cast<quint32>(names.size()), field);
+    bundle.append(field, 4);
+    qToLittleEndian<quint32>(static_cast<quint32>(index.size()), field);
+    bundle.append(field, 4);
+    bundle.append(index);
+
+    QByteArray content(static_cast<int>(size), Qt::Uninitialized);
+    for (int i = 0; i < names.size(); ++i) {
+        StandInServer::fillSynthetic(static_cast<quint32>(i + 1), 0, content.data(), size);
+        bundle.append(content);
+    }
+    return bundle;
+}
+
+// 大量小文件的热更新，withBundle 时同时发布打包文件
+static void setupHotfix(StandInServer& server, int count, qint64 size, bool withBundle = false)
+{
+    QJsonArray files;
+    QStringList names;
+    for (int i = 0; i < count; ++i) {
+        QString name = QString("hotfix_%1.dat").arg(i, 4, 10, QChar('0'));
+        server.addSyntheticFile(name, size, static_cast<quint32>(i + 1));
+        names.append(name);
+        QJsonObject file;
+        file["filename"] = name;
+        file["hash"] = server.fileHash(name);
+        files.append(file);
+    }
+    QByteArray manifest = makeManifest("2.0.0", QString(), 1, files);
+    if (withBundle) {
+        server.addFile("bundles/1.bundle", makeBundle(server, names, size));
+        QJsonObject object = QJsonDocument::fromJson(manifest).object();
+        object["bundle"] = "bundles/1.bundle";
+        manifest = QJsonDocument(object).toJson(QJsonDocument::Compact);
+    }
+    server.setManifest(manifest);
+}
+
+// 单个大安装包
+static void setupInstaller(StandInServer& server, qint64 size)
+{
+    const QString version = "9.0.0";
+    const QString name = "iNE_Setup_" + version + ".exe";
+    server.addSyntheticFile(name, size, 0xC0FFEE);
+    server.setManifest(makeManifest(version, server.fileHash(name), 0, QJsonArray()));
+}
+
+static StandInServer::Stats totalStats(const std::vector<StandInServer*>& servers)
+{
+    StandInServer::Stats total;
+    for (StandInServer* server : servers) {
+        StandInServer::Stats stats = server->stats();
+        total.requests += stats.requests;
+        total.bytesSent += stats.bytesSent;
+        total.failuresInjected += stats.failuresInjected;
+    }
+    return total;
+}
+
+// 第一个服务器作为 base_url，其余作为镜像
+static RunResult runUpdater(const QStringList& baseUrls, const std::vector<StandInServer*>& servers, int timeoutMs)
+{
+    UpdaterConfig config = UpdaterConfig::load();
+    config.baseUrl = baseUrls.front();
+    config.mirrors = baseUrls.mid(1);
+
+    Updater updater(std::make_unique<SemanticVersionComparator>(), config);
+    RunResult result;
+    QEventLoop loop;
+    QObject::connect(&updater, &Updater::finished, &loop, [&](bool success, const QString& message) {
+        result.success = success;
+        result.message = message;
+        loop.quit();
+    });
+    QTimer::singleShot(timeoutMs, &loop, [&]() {
+        result.message = "timeout";
+        loop.quit();
+    });
+
+    StandInServer::Stats before = totalStats(servers);
+    QElapsedTimer timer;
+    timer.start();
+    QTimer::singleShot(0, &updater, &Updater::process);
+    loop.exec();
+    result.wallMs = timer.elapsed();
+
+    StandInServer::Stats after = totalStats(servers);
+    result.requests = after.requests - before.requests;
+    result.bytesSent = after.bytesSent - before.bytesSent;
+    result.failuresInjected = after.failuresInjected - before.failuresInjected;
+    return result;
+}
+
+int main(int argc, char* argv[])
+{
+    qInstallMessageHandler(benchMessageHandle);
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption scenarioOption("scenario", "Run only the named scenario.", "name");
+    QCommandLineOption installerOption("installer-mb", "Installer size in MiB (default 1024).", "mb", "1024");
+    QCommandLineOption jsonOption("json", "Write results as JSON to the given path.", "path");
+    QCommandLineOption timeoutOption("timeout", "Per-run timeout in seconds (default 600).", "seconds", "600");
+    QCommandLineOption verboseOption("verbose", "Print updater debug output.");
+    QCommandLineOption catalogOption("catalog-size", "Number of versions in the version-compare catalog (default 100000).",
+        "count", "100000");
+    QCommandLineOption manifestOption("manifest-entries", "Number of files in the manifest-parse benchmark (default 50000).",
+        "count", "50000");
+    QCommandLineOption samplesOption("property-samples", "Number of random cases in version-properties (default 20000).",
+        "count", "20000");
+    QCommandLineOption seedOption("property-seed", "Random seed for version-properties (default 20240601).",
+        "seed", "20240601");
+    parser.addOptions({ scenarioOption, installerOption, jsonOption, timeoutOption, verboseOption, catalogOption,
+        manifestOption, samplesOption, seedOption });
+    parser.process(app);
+    verboseLog = parser.isSet(verboseOption);
+
+    const qint64 installerSize = parser.value(installerOption).toLongLong() * 1024 * 1024;
+    const int timeoutMs = parser.value(timeoutOption).toInt() * 1000;
+
+    std::vector<Scenario> scenarios = {
+        { "hotfix-500-small", "500 x 16KiB hotfix files, 20ms latency", [](StandInServer& server) {
+            setupHotfix(server, 500, 16 * 1024);
+            StandInServer::Faults faults;
+            faults.latencyMs = 20;
+            server.setFaults(faults);
+        }, 2 },
+        { "hotfix-500-bundle", "500 x 16KiB hotfix files published as one bundle, 20ms latency", [](StandInServer& server) {
+            setupHotfix(server, 500, 16 * 1024, true);
+            StandInServer::Faults faults;
+            faults.latencyMs = 20;
+            server.setFaults(faults);
+        }, 2 },
+        { "mirrors-failover", "100 x 64KiB hotfix files, primary fails every request, "
+            "mirrors at 150ms and 10ms latency, the slow one should lose the probe", [](StandInServer& server) {
+            setupHotfix(server, 100, 64 * 1024);
+            StandInServer::Faults faults;
+            faults.failureRate = 1.0;
+            server.setFaults(faults);
+        }, 1, {
+            [](StandInServer& server) {
+                setupHotfix(server, 100, 64 * 1024);
+                StandInServer::Faults faults;
+                faults.latencyMs = 150;
+                server.setFaults(faults);
+            },
+            [](StandInServer& server) {
+                setupHotfix(server, 100, 64 * 1024);
+                StandInServer::Faults faults;
+                faults.latencyMs = 10;
+                server.setFaults(faults);
+            },
+        } },
+        { "installer-large", "single installer download", [installerSize](StandInServer& server) {
+            setupInstaller(server, installerSize);
+        } },
+        { "stalls-1pct", "100 x 256KiB hotfix files, 1% of chunks stall for 200ms", [](StandInServer& server) {
+            setupHotfix(server, 100, 256 * 1024);
+            StandInServer::Faults faults;
+            faults.stallRate = 0.01;
+            faults.stallMs = 200;
+            server.setFaults(faults);
+        } },
+        { "failures-5pct", "100 x 64KiB hotfix files, 5% of requests fail", [](StandInServer& server) {
+            setupHotfix(server, 100, 64 * 1024);
+            StandInServer::Faults faults;
+            faults.failureRate = 0.05;
+            server.setFaults(faults);
+        } },
+    };
+
+    QTextStream out(stdout);
+    QJsonArray report;
+    bool allPassed = true;
+
+    if (!parser.isSet(scenarioOption) || parser.value(scenarioOption) == "version-compare") {
+        report.append(runVersionBenchmark(parser.value(catalogOption).toInt(), out));
+    }
+    if (!parser.isSet(scenarioOption) || parser.value(scenarioOption) == "version-properties") {
+        QJsonObject entry = runVersionProperties(parser.value(samplesOption).toInt(), parser.value(seedOption).toUInt(), out);
+        allPassed = allPassed && entry["passed"].toBool();
+        report.append(entry);
+    }
+    if (!parser.isSet(scenarioOption) || parser.value(scenarioOption) == "manifest-parse") {
+        report.append(runManifestBenchmark(parser.value(manifestOption).toInt(), out));
+    }
+
+    for (const Scenario& scenario : scenarios) {
+        if (parser.isSet(scenarioOption) && parser.value(scenarioOption) != scenario.name) {
+            continue;
+        }
+
+        // 服务器在自己的线程里跑，模拟真实的网络对端；镜像服务器共用这个线程
+        QThread serverThread;
+        std::vector<std::function<void(StandInServer&)>> setups = { scenario.setup };
+        setups.insert(setups.end(), scenario.mirrors.begin(), scenario.mirrors.end());
+        std::vector<StandInServer*> servers;
+        for (const auto& setup : setups) {
+            StandInServer* server = new StandInServer;
+            setup(*server);
+            server->moveToThread(&serverThread);
+            QObject::connect(&serverThread, &QThread::finished, server, &QObject::deleteLater);
+            servers.push_back(server);
+        }
+        serverThread.start();
+
+        QStringList baseUrls;
+        for (StandInServer* server : servers) {
+            bool listening = false;
+            QMetaObject::invokeMethod(server, "start", Qt::BlockingQueuedConnection,
+                Q_RETURN_ARG(bool, listening), Q_ARG(quint16, 0));
+            if (!listening) {
+                serverThread.quit();
+                serverThread.wait();
+                return 2;
+            }
+            baseUrls.append(QString("http://127.0.0.1:%1").arg(server->port()));
+        }
+
+        // 每个场景从空目录开始，状态文件都落在临时目录里
+        QTemporaryDir workDir;
+        const QString previousDir = QDir::currentPath();
+        QDir::setCurrent(workDir.path());
+
+        for (int run = 0; run < scenario.runs; ++run) {
+            RunResult result = runUpdater(baseUrls, servers, timeoutMs);
+            allPassed = allPassed && result.success;
+
+            out << scenario.name << " run " << run + 1 << ": "
+                << (result.success ? "ok" : "FAILED") << ", "
+                << result.wallMs << " ms, "
+                << result.requests << " requests, "
+                << result.bytesSent / 1024 << " KiB sent, "
+                << result.failuresInjected << " failures injected, "
+                << "peak memory " << peakMemoryBytes() / (1024 * 1024) << " MiB";
+            if (!result.success) {
+                out << " (" << result.message << ")";
+            }
+            out << Qt::endl;
+
+            QJsonObject entry;
+            entry["scenario"] = scenario.name;
+            entry["description"] = scenario.description;
+            entry["run"] = run + 1;
+            entry["success"] = result.success;
+            entry["message"] = result.message;
+            entry["wall_ms"] = result.wallMs;
+            entry["requests"] = result.requests;
+            entry["bytes_sent"] = result.bytesSent;
+            entry["failures_injected"] = result.failuresInjected;
+            entry["peak_memory_bytes"] = peakMemoryBytes();
+            report.append(entry);
+        }
+
+        QDir::setCurrent(previousDir);
+        serverThread.quit();
+        serverThread.wait();
+    }
+
+    if (parser.isSet(jsonOption)) {
+        QFile file(parser.value(jsonOption));
+        if (file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            file.write(QJsonDocument(report).toJson());
+        }
+    }
+    return allPassed ? 0 : 1;
+}
@@ -0,0 +1,151 @@
+﻿#include "manifestBench.h"
+#include "../src/manifestTable.h"
+
+#include <vector>
+
+#include <QCryptographicHash>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+
+
+// 每种方式重复解析的次数，取最快的一次
+static const int PARSE_RUNS = 5;
+
+// 目录结构和文件名仿照真实的客户端：几百个目录，每个文件十几个字符，约一成文件有差分补丁
+static QJsonObject makeManifest(int entries)
+{
+    auto md5 = [](const QByteArray& seed) {
+        return QString::fromLatin1(QCryptographicHash::hash(seed, QCryptographicHash::Md5).toHex());
+    };
+    QJsonArray files;
+    for (int i = 0; i < entries; ++i) {
+        QJsonObject file;
+        file["filename"] = QString("data/pack%1/level%2/asset_%3.bin").arg(i % 300).arg(i % 7).arg(i);
+        file["hash"] = md5(QByteArray::number(i));
+        if (i % 10 == 0) {
+            file["patch_from"] = QJsonArray{ md5("old" + QByteArray::number(i)), md5("older" + QByteArray::number(i)) };
+        }
+        files.append(file);
+    }
+    QJsonObject manifest;
+    manifest["version"] = "2.0.0";
+    manifest["hash"] = md5("installer");
+    manifest["hotfix"] = "42";
+    manifest["main_program"] = "bin/main.exe";
+    manifest["files"] = files;
+    return manifest;
+}
+
+// 修改前 Updater::parseManifest 的做法，作为对照
+static std::vector<FileInfo> legacyParse(const QByteArray& json)
+{
+    QJsonObject manifest = QJsonDocument::fromJson(json).object();
+    std::vector<FileInfo> list;
+    for (const auto& file : manifest["files"].toArray()) {
+        FileInfo fileInfo;
+        fileInfo.filename = file.toObject()["filename"].toString().toStdString();
+        fileInfo.hash = file.toObject()["hash"].toString().toStdString();
+        for (const auto& patchBase : file.toObject()["patch_from"].toArray()) {
+            fileInfo.patchFrom.push_back(patchBase.toString().toStdString());
+        }
+        list.push_back(fileInfo);
+    }
+    return list;
+}
+
+static size_t legacyMemoryBytes(const std::vector<FileInfo>& list)
+{
+    size_t bytes = list.capacity() * sizeof(FileInfo);
+    for (const FileInfo& file : list) {
+        bytes += ManifestTable::heapBytes(file.filename) + ManifestTable::heapBytes(file.hash);
+        bytes += file.patchFrom.capacity() * sizeof(std::string);
+        for (const std::string& patchBase : file.patchFrom) {
+            bytes += ManifestTable::heapBytes(patchBase);
+        }
+    }
+    return bytes;
+}
+
+// 只发布热更新、没有安装包哈希的版本信息（和 benchMain 的热更新场景一样）转成 CBOR 后能原样解析回来
+static bool emptyHashRoundTrip()
+{
+    QJsonObject manifest = makeManifest(3);
+    manifest["hash"] = QString();
+    ManifestTable fromJson;
+    ManifestTable fromCbor;
+    if (!fromJson.fromJson(manifest) || !fromCbor.fromCbor(ManifestTable::cborFromJson(manifest))) {
+        return false;
+    }
+    manifest.remove("hash");
+    ManifestTable withoutHash;
+    return withoutHash.fromCbor(ManifestTable::cborFromJson(manifest))
+        && fromCbor.hash.empty() && withoutHash.hash.empty() && fromJson.hash.empty()
+        && fromCbor.version == fromJson.version && fromCbor.hotfix == fromJson.hotfix
+        && fromCbor.mainProgram == fromJson.mainProgram && fromCbor.size() == fromJson.size();
+}
+
+// 重复执行 parse，返回最快一次的毫秒数
+template <typename Parse>
+static double bestOf(Parse parse)
+{
+    double best = 0;
+    for (int run = 0; run < PARSE_RUNS; ++run) {
+        QElapsedTimer timer;
+        timer.start();
+        parse();
+        double ms = timer.nsecsElapsed() / 1e6;
+        best = run == 0 ? ms : qMin(best, ms);
+    }
+    return best;
+}
+
+QJsonObject runManifestBenchmark(int entries, QTextStream& out)
+{
+    const QJsonObject manifest = makeManifest(entries);
+    const QByteArray json = QJsonDocument(manifest).toJson(QJsonDocument::Compact);
+    const QByteArray cbor = ManifestTable::cborFromJson(manifest);
+
+    std::vector<FileInfo> legacy;
+    double legacyMs = bestOf([&]() {
+        legacy = legacyParse(json);
+    });
+    ManifestTable fromJson;
+    double jsonMs = bestOf([&]() {
+        fromJson.fromJson(QJsonDocument::fromJson(json).object());
+    });
+    ManifestTable fromCbor;
+    bool cborOk = true;
+    double cborMs = bestOf([&]() {
+        cborOk = fromCbor.fromCbor(cbor) && cborOk;
+    });
+    // 两种格式必须解析出相同的内容
+    bool consistent = cborOk && fromCbor.size() == static_cast<int>(legacy.size());
+    for (int i = 0; consistent && i < fromCbor.size(); ++i) {
+        consistent = fromCbor.path(i) == legacy[i].filename && fromCbor.hexDigest(i) == legacy[i].hash
+            && fromCbor.patchCount(i) == static_cast<int>(legacy[i].patchFrom.size());
+    }
+    const bool roundTrip = emptyHashRoundTrip();
+
+    const size_t legacyBytes = legacyMemoryBytes(legacy);
+    const size_t tableBytes = fromCbor.memoryBytes();
+    out << "manifest-parse, " << entries << " files, payload json " << json.size() / 1024 << " KiB, cbor "
+        << cbor.size() / 1024 << " KiB; parse ms: legacy json " << legacyMs << ", json to table " << jsonMs
+        << ", cbor stream " << cborMs << "; memory KiB: legacy " << legacyBytes / 1024 << ", table "
+        << tableBytes / 1024 << (consistent ? "" : "; RESULTS DIFFER")
+        << (roundTrip ? "" : "; EMPTY HASH ROUND TRIP FAILED") << Qt::endl;
+
+    QJsonObject entry;
+    entry["scenario"] = "manifest-parse";
+    entry["entries"] = entries;
+    entry["json_bytes"] = json.size();
+    entry["cbor_bytes"] = cbor.size();
+    entry["legacy_parse_ms"] = legacyMs;
+    entry["json_table_parse_ms"] = jsonMs;
+    entry["cbor_table_parse_ms"] = cborMs;
+    entry["legacy_memory_bytes"] = static_cast<double>(legacyBytes);
+    entry["table_memory_bytes"] = static_cast<double>(tableBytes);
+    entry["consistent"] = consistent;
+    entry["empty_hash_round_trip"] = roundTrip;
+    return entry;
+}
@@ -0,0 +1,15 @@
+﻿#pragma once
+
+#include <QJsonObject>
+#include <QTextStream>
+
+
+// ======================
+// 版本信息解析基准
+// ======================
+// 生成一个有 entries 个文件的版本信息，对比三种解析方式的耗时和解析结果占用的内存：
+//   - 修改前的方式：JSON 解析成 QJsonObject，再逐个转成 std::vector<FileInfo>
+//   - JSON 解析后转成 ManifestTable
+//   - CBOR 流式解析成 ManifestTable
+// 内存按容器和字符串的容量估算，不包括解析过程中 QJsonDocument 的临时占用
+QJsonObject runManifestBenchmark(int entries, QTextStream& out);
@@ -0,0 +1,411 @@
+﻿#include "standInServer.h"
+#include "../src/manifestTable.h"
+
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QCryptographicHash>
+#include <QJsonDocument>
+#include <QRandomGenerator>
+#include <QtEndian>
+
+#include <QDebug>
+
+
+static const qint64 SYNTHETIC_BLOCK_SIZE = 64 * 1024;
+// 每次写入 socket 的数据块大小，也是卡顿注入的粒度
+static const qint64 SEND_CHUNK_SIZE = 16 * 1024;
+// socket 发送缓冲中积压超过这个量就等 bytesWritten 再继续，避免把大文件整个塞进内存
+static const qint64 MAX_PENDING_WRITE = 256 * 1024;
+// 限速时的补充间隔
+static const int BANDWIDTH_TICK_MS = 10;
+
+static const QByteArray LAST_MODIFIED = "Mon, 01 Jan 2024 00:00:00 GMT";
+
+
+// 一个客户端连接，按 HTTP/1.1 keep-alive 顺序处理请求
+class StandInServer::Connection : public QObject
+{
+public:
+    Connection(StandInServer* owner, QTcpSocket* socket)
+        : QObject(socket), owner(owner), socket(socket),
+          rng(static_cast<quint32>(reinterpret_cast<quintptr>(socket)))
+    {
+        connect(socket, &QTcpSocket::readyRead, this, [this]() { onReadyRead(); });
+        connect(socket, &QTcpSocket::bytesWritten, this, [this]() { pump(); });
+        connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+    }
+
+private:
+    void onReadyRead() {
+        buffer.append(socket->readAll());
+        processNext();
+    }
+
+    // 当前没有在处理的请求时，解析缓冲区中的下一个请求
+    void processNext() {
+        if (busy) {
+            return;
+        }
+        int end = buffer.indexOf("\r\n\r\n");
+        if (end < 0) {
+            return;
+        }
+        QByteArray head = buffer.left(end);
+        buffer.remove(0, end + 4);
+
+        Request request;
+        QList<QByteArray> lines = head.split('\n');
+        QList<QByteArray> requestLine = lines.value(0).trimmed().split(' ');
+        request.method = requestLine.value(0);
+        request.path = requestLine.value(1);
+        for (int i = 1; i < lines.size(); ++i) {
+            int colon = lines[i].indexOf(':');
+            if (colon > 0) {
+                request.headers.insert(lines[i].left(colon).trimmed().toLower(), lines[i].mid(colon + 1).trimmed());
+            }
+        }
+
+        busy = true;
+        ++owner->requestCount;
+        closeAfter = request.headers.value("connection").toLower() == "close";
+
+        if (owner->faults.latencyMs > 0) {
+            QTimer::singleShot(owner->faults.latencyMs, this, [this, request]() { respond(request); });
+        }
+        else {
+            respond(request);
+        }
+    }
+
+    void respond(const Request& request) {
+        const Faults& faults = owner->faults;
+        bool headOnly = request.method == "HEAD";
+
+        // 注入失败：一半直接返回503，一半在传输中途断开连接
+        cutAt = -1;
+        if (faults.failureRate > 0 && rng.generateDouble() < faults.failureRate) {
+            ++owner->failuresInjected;
+            if (rng.generateDouble() < 0.5) {
+                sendSimple(503, "Service Unavailable");
+                return;
+            }
+            cutAt = 0;  // 在下面确定响应体范围后改成中点
+        }
+
+        if (request.path == "/api/updater/version") {
+            // 两种格式是同一份版本信息的不同表示，ETag 各不相同
+            const bool cbor = request.headers.value("accept").contains("application/cbor");
+            QByteArray payload = cbor ? owner->manifestCbor : owner->manifest;
+            QByteArray etag = "\"" + QCryptographicHash::hash(payload, QCryptographicHash::Md5).toHex() + "\"";
+            if (request.headers.value("if-none-match") == etag) {
+                sendHeaders(304, "Not Modified", { { "ETag", etag }, { "Vary", "Accept" } }, 0);
+                finishResponse();
+                return;
+            }
+            QList<QPair<QByteArray, QByteArray>> headers = {
+                { "ETag", etag },
+                { "Content-Type", cbor ? "application/cbor" : "application/json" },
+                { "Vary", "Accept" },
+            };
+            if (request.headers.value("accept-encoding").contains("deflate")) {
+                // qCompress 的输出去掉4字节长度前缀就是 zlib 流，即 HTTP 的 deflate 编码
+                payload = qCompress(payload).mid(4);
+                headers.append({ "Content-Encoding", "deflate" });
+            }
+            startBody(200, "OK", headers, payload, nullptr, 0, payload.size(), headOnly);
+            return;
+        }
+
+        const QByteArray prefix = "/updater/";
+        auto it = request.path.startsWith(prefix)
+            ? owner->files.find(QString::fromUtf8(QByteArray::fromPercentEncoding(request.path.mid(prefix.size()))))
+            : owner->files.end();
+        if (it == owner->files.end()) {
+            sendSimple(404, "Not Found");
+            return;
+        }
+
+        const File& file = it->second;
+        QByteArray etag = "\"" + file.md5.toLatin1() + "\"";
+        QList<QPair<QByteArray, QByteArray>> headers = {
+            { "ETag", etag },
+            { "Last-Modified", LAST_MODIFIED },
+            { "Content-Type", "application/octet-stream" }
+        };
+        if (owner->rangeSupported) {
+            headers.append({ "Accept-Ranges", "bytes" });
+        }
+
+        // Range: bytes=<start>-[<end>]，If-Range 与当前版本不符时忽略 Range
+        qint64 start = 0;
+        qint64 end = file.size;
+        QByteArray range = request.headers.value("range");
+        QByteArray ifRange = request.headers.value("if-range");
+        bool useRange = owner->rangeSupported && range.startsWith("bytes=")
+            && (ifRange.isEmpty() || ifRange == etag || ifRange == LAST_MODIFIED);
+        if (useRange) {
+            QByteArray spec = range.mid(6);
+            int dash = spec.indexOf('-');
+            start = spec.left(dash).toLongLong();
+            QByteArray last = spec.mid(dash + 1);
+            if (!last.isEmpty()) {
+                end = qMin(file.size, last.toLongLong() + 1);
+            }
+            if (start >= file.size || start >= end) {
+                sendHeaders(416, "Range Not Satisfiable", { { "Content-Range", "bytes */" + QByteArray::number(file.size) } }, 0);
+                finishResponse();
+                return;
+            }
+            headers.append({ "Content-Range", "bytes " + QByteArray::number(start) + "-"
+                + QByteArray::number(end - 1) + "/" + QByteArray::number(file.size) });
+            startBody(206, "Partial Content", headers, QByteArray(), &file, start, end, headOnly);
+            return;
+        }
+        startBody(200, "OK", headers, QByteArray(), &file, start, end, headOnly);
+    }
+
+    void sendSimple(int status, const QByteArray& reason) {
+        startBody(status, reason, {}, reason, nullptr, 0, reason.size(), false);
+    }
+
+    void sendHeaders(int status, const QByteArray& reason, const QList<QPair<QByteArray, QByteArray>>& headers, qint64 contentLength) {
+        QByteArray head = "HTTP/1.1 " + QByteArray::number(status) + " " + reason + "\r\n";
+        for (const auto& header : headers) {
+            head += header.first + ": " + header.second + "\r\n";
+        }
+        head += "Content-Length: " + QByteArray::number(contentLength) + "\r\n";
+        head += closeAfter ? "Connection: close\r\n" : "Connection: keep-alive\r\n";
+        head += "\r\n";
+        socket->write(head);
+        owner->bytesSent += head.size();
+    }
+
+    void startBody(int status, const QByteArray& reason, const QList<QPair<QByteArray, QByteArray>>& headers,
+        const QByteArray& payload, const File* file, qint64 start, qint64 end, bool headOnly) {
+        sendHeaders(status, reason, headers, end - start);
+        if (headOnly) {
+            finishResponse();
+            return;
+        }
+        body = payload;
+        bodyFile = file;
+        bodyOffset = start;
+        bodyEnd = end;
+        if (cutAt >= 0) {
+            cutAt = start + (end - start) / 2;
+        }
+        sending = true;
+        budget = 0;
+        budgetClock.start();
+        pump();
+    }
+
+    // 尽量多地发送响应体，受发送缓冲、带宽和卡顿注入限制
+    void pump() {
+        if (!sending || paused) {
+            return;
+        }
+        const Faults& faults = owner->faults;
+        QByteArray chunk;
+        while (bodyOffset < bodyEnd) {
+            if (socket->bytesToWrite() > MAX_PENDING_WRITE) {
+                return;  // 等 bytesWritten
+            }
+
+            qint64 size = qMin(SEND_CHUNK_SIZE, bodyEnd - bodyOffset);
+            if (faults.bandwidthBytesPerSec > 0) {
+                budget = qMin(budget + budgetClock.restart() * faults.bandwidthBytesPerSec / 1000,
+                    faults.bandwidthBytesPerSec / 10);
+                if (budget <= 0) {
+                    pauseFor(BANDWIDTH_TICK_MS);
+                    return;
+                }
+                size = qMin(size, budget);
+            }
+            if (faults.stallRate > 0 && !stallChecked) {
+                stallChecked = true;
+                if (rng.generateDouble() < faults.stallRate) {
+                    pauseFor(faults.stallMs);
+                    return;
+                }
+            }
+            if (cutAt >= 0 && bodyOffset >= cutAt) {
+                // 注入的中途断开
+                sending = false;
+                socket->abort();
+                return;
+            }
+
+            if (bodyFile == nullptr) {
+                chunk = body.mid(static_cast<int>(bodyOffset), static_cast<int>(size));
+            }
+            else if (!bodyFile->synthetic) {
+                chunk = bodyFile->content.mid(static_cast<int>(bodyOffset), static_cast<int>(size));
+            }
+            else {
+                chunk.resize(static_cast<int>(size));
+                fillSynthetic(bodyFile->seed, bodyOffset, chunk.data(), size);
+            }
+            socket->write(chunk);
+            owner->bytesSent += size;
+            bodyOffset += size;
+            budget -= size;
+            stallChecked = false;
+        }
+        finishResponse();
+    }
+
+    void pauseFor(int ms) {
+        paused = true;
+        QTimer::singleShot(ms, this, [this]() {
+            paused = false;
+            pump();
+        });
+    }
+
+    void finishResponse() {
+        sending = false;
+        body.clear();
+        bodyFile = nullptr;
+        busy = false;
+        if (closeAfter) {
+            socket->disconnectFromHost();
+            return;
+        }
+        processNext();
+    }
+
+    StandInServer* owner;
+    QTcpSocket* socket;
+    QRandomGenerator rng;
+    QByteArray buffer;
+    bool busy = false;
+    bool closeAfter = false;
+
+    // 正在发送的响应体
+    bool sending = false;
+    bool paused = false;
+    bool stallChecked = false;
+    QByteArray body;
+    const File* bodyFile = nullptr;
+    qint64 bodyOffset = 0;
+    qint64 bodyEnd = 0;
+    qint64 cutAt = -1;
+    qint64 budget = 0;
+    QElapsedTimer budgetClock;
+};
+
+
+StandInServer::StandInServer(QObject* parent)
+    : QObject(parent)
+{
+}
+
+StandInServer::~StandInServer() = default;
+
+void StandInServer::setFaults(const Faults& faults) {
+    this->faults = faults;
+}
+
+void StandInServer::setManifest(const QByteArray& json) {
+    manifest = json;
+    manifestCbor = ManifestTable::cborFromJson(QJsonDocument::fromJson(json).object());
+}
+
+void StandInServer::addFile(const QString& name, const QByteArray& content) {
+    File file;
+    file.content = content;
+    file.size = content.size();
+    file.md5 = QCryptographicHash::hash(content, QCryptographicHash::Md5).toHex();
+    files[name] = file;
+}
+
+void StandInServer::addSyntheticFile(const QString& name, qint64 size, quint32 seed) {
+    File file;
+    file.size = size;
+    file.seed = seed;
+    file.synthetic = true;
+
+    QCryptographicHash hasher(QCryptographicHash::Md5);
+    QByteArray block(static_cast<int>(SYNTHETIC_BLOCK_SIZE), Qt::Uninitialized);
+    for (qint64 offset = 0; offset < size; offset += SYNTHETIC_BLOCK_SIZE) {
+        qint64 length = qMin(SYNTHETIC_BLOCK_SIZE, size - offset);
+        fillSynthetic(seed, offset, block.data(), length);
+        hasher.addData(block.constData(), static_cast<int>(length));
+    }
+    file.md5 = hasher.result().toHex();
+    files[name] = file;
+}
+
+void StandInServer::setRangeSupported(bool supported) {
+    rangeSupported = supported;
+}
+
+QString StandInServer::fileHash(const QString& name) const {
+    auto it = files.find(name);
+    return it != files.end() ? it->second.md5 : QString();
+}
+
+bool StandInServer::start(quint16 port) {
+    server = new QTcpServer(this);
+    connect(server, &QTcpServer::newConnection, this, &StandInServer::onNewConnection);
+    if (!server->listen(QHostAddress::LocalHost, port)) {
+        qWarning() << "Stand-in server failed to listen: " << server->errorString();
+        return false;
+    }
+    return true;
+}
+
+quint16 StandInServer::port() const {
+    return server != nullptr ? server->serverPort() : 0;
+}
+
+StandInServer::Stats StandInServer::stats() const {
+    Stats stats;
+    stats.requests = requestCount;
+    stats.bytesSent = bytesSent;
+    stats.failuresInjected = failuresInjected;
+    return stats;
+}
+
+void StandInServer::fillSynthetic(quint32 seed, qint64 offset, char* out, qint64 length) {
+    // xorshift64，每个块用 (种子, 块号) 重新播种，保证任意偏移都能直接算出来
+    while (length > 0) {
+        qint64 block = offset / SYNTHETIC_BLOCK_SIZE;
+        qint64 inBlock = offset % SYNTHETIC_BLOCK_SIZE;
+        quint64 state = (static_cast<quint64>(seed) << 32) ^ static_cast<quint64>(block) ^ 0x9E3779B97F4A7C15ULL;
+
+        // 跳到块内偏移所在的8字节
+        qint64 word = 0;
+        quint64 value = 0;
+        for (; word <= inBlock / 8; ++word) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            value = state;
+        }
+        qint64 take = qMin(length, SYNTHETIC_BLOCK_SIZE - inBlock);
+        for (qint64 i = 0; i < take; ++i) {
+            qint64 pos = inBlock + i;
+            if (pos % 8 == 0 && i > 0) {
+                state ^= state << 13;
+                state ^= state >> 7;
+                state ^= state << 17;
+                value = state;
+            }
+            out[i] = static_cast<char>(value >> ((pos % 8) * 8));
+        }
+        out += take;
+        offset += take;
+        length -= take;
+    }
+}
+
+void StandInServer::onNewConnection() {
+    while (server->hasPendingConnections()) {
+        QTcpSocket* socket = server->nextPendingConnection();
+        new Connection(this, socket);
+    }
+}
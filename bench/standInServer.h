@@ -0,0 +1,96 @@
+﻿#pragma once
+
+#include <atomic>
+#include <map>
+
+#include <QObject>
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+
+class QTcpServer;
+class QTcpSocket;
+
+
+// ======================
+// 本地替身更新服务器
+// ======================
+// 用 QTcpServer 实现的极简 HTTP/1.1 服务器，只用于基准测试，模拟真实更新服务器：
+//   GET  /api/updater/version   版本信息（支持 ETag/304，客户端接受时用 deflate 压缩，Accept 含 application/cbor 时返回 CBOR）
+//   GET  /updater/<name>        文件内容（支持 Range/If-Range/206，以及 HEAD）
+// 文件可以是显式给定的内容，也可以是按种子即时生成的合成数据（大文件不占内存）
+// 可以注入延迟、带宽限制、请求失败和传输卡顿，并统计请求数和发送的字节数
+// 服务器对象应放在独立线程中运行，避免和被测的 Updater 抢事件循环
+class StandInServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    // 故障注入参数
+    struct Faults {
+        int latencyMs = 0;                  // 每个请求在发送响应头之前的延迟
+        qint64 bandwidthBytesPerSec = 0;    // 每个连接的发送带宽上限，0 表示不限
+        double failureRate = 0.0;           // 请求失败的概率（一半直接503，一半传到中途断开）
+        double stallRate = 0.0;             // 每发送一个数据块时卡住的概率
+        int stallMs = 0;                    // 每次卡住的时长
+    };
+
+    struct Stats {
+        qint64 requests = 0;
+        qint64 bytesSent = 0;
+        qint64 failuresInjected = 0;
+    };
+
+    explicit StandInServer(QObject* parent = nullptr);
+    ~StandInServer();
+
+    // 以下配置接口应在 start() 之前调用
+    void setFaults(const Faults& faults);
+    void setManifest(const QByteArray& json);
+    void addFile(const QString& name, const QByteArray& content);
+    void addSyntheticFile(const QString& name, qint64 size, quint32 seed);
+    void setRangeSupported(bool supported);
+
+    // 文件的MD5（hex），用于生成版本信息
+    QString fileHash(const QString& name) const;
+
+    // 在服务器线程中调用，port 为0时由系统分配
+    Q_INVOKABLE bool start(quint16 port = 0);
+    quint16 port() const;
+
+    Stats stats() const;
+
+    // 合成数据：按 64KiB 分块，每块由 (种子, 块号) 决定，可以从任意偏移生成
+    static void fillSynthetic(quint32 seed, qint64 offset, char* out, qint64 length);
+
+private:
+    struct File {
+        QByteArray content;     // 显式内容，为空时使用合成数据
+        qint64 size = 0;
+        quint32 seed = 0;
+        bool synthetic = false;
+        QString md5;
+    };
+
+    struct Request {
+        QByteArray method;
+        QByteArray path;
+        QHash<QByteArray, QByteArray> headers;  // 名称统一小写
+    };
+
+    class Connection;
+    friend class Connection;
+
+    void onNewConnection();
+
+    QTcpServer* server = nullptr;
+    Faults faults;
+    QByteArray manifest;
+    QByteArray manifestCbor;
+    std::map<QString, File> files;
+    bool rangeSupported = true;
+
+    std::atomic<qint64> requestCount{ 0 };
+    std::atomic<qint64> bytesSent{ 0 };
+    std::atomic<qint64> failuresInjected{ 0 };
+};
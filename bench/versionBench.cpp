@@ -0,0 +1,311 @@
+﻿#include "versionBench.h"
+#include "../src/versionComparator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <QString>
+
+
+// 修改前 SemanticVersionComparator 的实现，作为对照
+static std::vector<int> legacySplitVersion(const std::string& version)
+{
+    std::vector<int> parts;
+    size_t start = 0;
+    size_t end = version.find('.');
+    while (end != std::string::npos) {
+        parts.push_back(std::stoi(version.substr(start, end - start)));
+        start = end + 1;
+        end = version.find('.', start);
+    }
+    parts.push_back(std::stoi(version.substr(start)));
+    return parts;
+}
+
+static bool legacyIsNewer(const std::string& remote, const std::string& local)
+{
+    auto remoteParts = legacySplitVersion(remote);
+    auto localParts = legacySplitVersion(local);
+    for (size_t i = 0; i < std::min(remoteParts.size(), localParts.size()); ++i) {
+        if (remoteParts[i] > localParts[i]) return true;
+        if (remoteParts[i] < localParts[i]) return false;
+    }
+    return remoteParts.size() > localParts.size();
+}
+
+static std::vector<std::string> makeCatalog(int size, bool withPreRelease)
+{
+    static const char* channels[] = { "", "beta.", "rc.", "nightly." };
+    std::mt19937 random(20240601);
+    std::vector<std::string> catalog;
+    catalog.reserve(size);
+    for (int i = 0; i < size; ++i) {
+        std::string version = std::to_string(random() % 5) + "." + std::to_string(random() % 30) + "."
+            + std::to_string(random() % 200);
+        if (withPreRelease) {
+            int channel = random() % 4;
+            if (channel > 0) {
+                version += std::string("-") + channels[channel] + std::to_string(random() % 50);
+            }
+            if (channel == 3) {
+                version += "+build." + std::to_string(random() % 100000);
+            }
+        }
+        catalog.push_back(version);
+    }
+    return catalog;
+}
+
+// 按 SemVer 2.0 规则直接写的参考实现：拆成字符串再逐段比较，不考虑性能，只用来对照结果
+// 只用于生成器产生的合法版本号
+static std::vector<std::string> splitOn(const std::string& text, char separator)
+{
+    std::vector<std::string> parts;
+    size_t start = 0;
+    size_t end = text.find(separator);
+    while (end != std::string::npos) {
+        parts.push_back(text.substr(start, end - start));
+        start = end + 1;
+        end = text.find(separator, start);
+    }
+    parts.push_back(text.substr(start));
+    return parts;
+}
+
+static int referenceCompare(const std::string& a, const std::string& b)
+{
+    auto split = [](const std::string& version, std::vector<unsigned long long>& core, std::vector<std::string>& pre) {
+        const std::string rest = version.substr(0, version.find('+'));
+        const size_t dash = rest.find('-');
+        for (const std::string& part : splitOn(rest.substr(0, dash), '.')) {
+            core.push_back(std::stoull(part));
+        }
+        core.resize(3, 0);
+        if (dash != std::string::npos) {
+            pre = splitOn(rest.substr(dash + 1), '.');
+        }
+    };
+    auto isNumeric = [](const std::string& identifier) {
+        return identifier.find_first_not_of("0123456789") == std::string::npos;
+    };
+
+    std::vector<unsigned long long> coreA, coreB;
+    std::vector<std::string> preA, preB;
+    split(a, coreA, preA);
+    split(b, coreB, preB);
+    if (coreA != coreB) {
+        return coreA < coreB ? -1 : 1;
+    }
+    if (preA.empty() || preB.empty()) {
+        return preA.empty() == preB.empty() ? 0 : (preA.empty() ? 1 : -1);
+    }
+    for (size_t i = 0; i < std::min(preA.size(), preB.size()); ++i) {
+        const bool numericA = isNumeric(preA[i]);
+        const bool numericB = isNumeric(preB[i]);
+        if (numericA != numericB) {
+            return numericA ? -1 : 1;
+        }
+        if (numericA) {
+            const unsigned long long valueA = std::stoull(preA[i]);
+            const unsigned long long valueB = std::stoull(preB[i]);
+            if (valueA != valueB) {
+                return valueA < valueB ? -1 : 1;
+            }
+        }
+        else if (preA[i] != preB[i]) {
+            return preA[i] < preB[i] ? -1 : 1;
+        }
+    }
+    if (preA.size() != preB.size()) {
+        return preA.size() < preB.size() ? -1 : 1;
+    }
+    return 0;
+}
+
+// 随机生成合法的版本号，取值范围故意很小，让相等和首尾相接的大小关系经常出现，传递性才检查得到
+// plain 为true时只有 主.次.修订
+static std::string randomVersion(std::mt19937& random, bool plain)
+{
+    static const char* words[] = { "alpha", "beta", "rc", "x-y", "A1" };
+    std::string version = std::to_string(random() % 3) + "." + std::to_string(random() % 3) + "."
+        + std::to_string(random() % 3);
+    if (plain) {
+        return version;
+    }
+    if (random() % 2 == 0) {
+        const int count = 1 + random() % 3;
+        for (int i = 0; i < count; ++i) {
+            version += i == 0 ? "-" : ".";
+            if (random() % 2 == 0) {
+                version += words[random() % 5];
+            }
+            else {
+                version += std::to_string(random() % 12);
+            }
+        }
+    }
+    if (random() % 4 == 0) {
+        version += "+build." + std::to_string(random() % 100);
+    }
+    return version;
+}
+
+static int sign(int value)
+{
+    return (value > 0) - (value < 0);
+}
+
+static int semverCompare(const std::string& a, const std::string& b)
+{
+    return sign(SemanticVersion::compare(SemanticVersion::parse(a), SemanticVersion::parse(b)));
+}
+
+QJsonObject runVersionProperties(int samples, quint32 seed, QTextStream& out)
+{
+    std::mt19937 random(seed);
+    SemanticVersionComparator comparator;
+    int invalid = 0;
+    int reflexivity = 0;
+    int antisymmetry = 0;
+    int transitivity = 0;
+    int chains = 0;
+    int reference = 0;
+    int build = 0;
+    int comparatorMismatch = 0;
+    int legacy = 0;
+    QString firstFailure;
+    auto report = [&firstFailure](int& counter, const std::string& what) {
+        if (counter++ == 0 && firstFailure.isEmpty()) {
+            firstFailure = QString::fromStdString(what);
+        }
+    };
+
+    for (int i = 0; i < samples; ++i) {
+        const std::string a = randomVersion(random, false);
+        const std::string b = randomVersion(random, false);
+        const std::string c = randomVersion(random, false);
+        if (!SemanticVersion::parse(a).valid || !SemanticVersion::parse(b).valid || !SemanticVersion::parse(c).valid) {
+            report(invalid, "invalid: " + a + " " + b + " " + c);
+            continue;
+        }
+
+        const int ab = semverCompare(a, b);
+        const int bc = semverCompare(b, c);
+        const int ac = semverCompare(a, c);
+        if (semverCompare(a, a) != 0) {
+            report(reflexivity, "reflexivity: " + a);
+        }
+        if (ab != -semverCompare(b, a)) {
+            report(antisymmetry, "antisymmetry: " + a + " " + b);
+        }
+        if ((ab <= 0 && bc <= 0) || (ab >= 0 && bc >= 0)) {
+            ++chains;
+            const bool broken = ab <= 0 && bc <= 0 ? ac > 0 : ac < 0;
+            if (broken) {
+                report(transitivity, "transitivity: " + a + " " + b + " " + c);
+            }
+        }
+        if (ab != referenceCompare(a, b)) {
+            report(reference, "reference: " + a + " " + b);
+        }
+        // 换一个构建元数据不改变比较结果
+        const std::string rebuilt = a.substr(0, a.find('+')) + "+other." + std::to_string(i);
+        if (semverCompare(a, rebuilt) != 0 || semverCompare(rebuilt, b) != ab) {
+            report(build, "build metadata: " + a + " " + rebuilt + " " + b);
+        }
+        if (comparator.isNewer(a, b) != (ab > 0)) {
+            report(comparatorMismatch, "isNewer: " + a + " " + b);
+        }
+
+        const std::string x = randomVersion(random, true);
+        const std::string y = randomVersion(random, true);
+        if (legacyIsNewer(x, y) != (semverCompare(x, y) > 0)) {
+            report(legacy, "legacy: " + x + " " + y);
+        }
+    }
+
+    const bool passed = invalid + reflexivity + antisymmetry + transitivity + reference + build
+        + comparatorMismatch + legacy == 0;
+    out << "version-properties, " << samples << " samples, seed " << seed << ", " << chains
+        << " transitive chains: " << (passed ? QString("ok") : "FAILED (" + firstFailure + ")") << Qt::endl;
+
+    QJsonObject entry;
+    entry["scenario"] = "version-properties";
+    entry["samples"] = samples;
+    entry["seed"] = static_cast<double>(seed);
+    entry["passed"] = passed;
+    entry["transitive_chains"] = chains;
+    entry["invalid"] = invalid;
+    entry["reflexivity_failures"] = reflexivity;
+    entry["antisymmetry_failures"] = antisymmetry;
+    entry["transitivity_failures"] = transitivity;
+    entry["reference_mismatches"] = reference;
+    entry["build_metadata_failures"] = build;
+    entry["comparator_mismatches"] = comparatorMismatch;
+    entry["legacy_mismatches"] = legacy;
+    if (!passed) {
+        entry["first_failure"] = firstFailure;
+    }
+    return entry;
+}
+
+// 对目录排序并返回每次比较的平均纳秒数
+template <typename T, typename Less>
+static double timeSort(std::vector<T> items, Less less)
+{
+    long long comparisons = 0;
+    auto counted = [&](const T& a, const T& b) {
+        ++comparisons;
+        return less(a, b);
+    };
+    auto start = std::chrono::steady_clock::now();
+    std::sort(items.begin(), items.end(), counted);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return comparisons > 0
+        ? std::chrono::duration<double, std::nano>(elapsed).count() / comparisons
+        : 0.0;
+}
+
+QJsonObject runVersionBenchmark(int catalogSize, QTextStream& out)
+{
+    const std::vector<std::string> plain = makeCatalog(catalogSize, false);
+    const std::vector<std::string> full = makeCatalog(catalogSize, true);
+
+    double legacyNs = timeSort(plain, [](const std::string& a, const std::string& b) {
+        return legacyIsNewer(b, a);
+    });
+    double plainNs = timeSort(plain, [](const std::string& a, const std::string& b) {
+        return SemanticVersion::compare(SemanticVersion::parse(a), SemanticVersion::parse(b)) < 0;
+    });
+    double fullNs = timeSort(full, [](const std::string& a, const std::string& b) {
+        return SemanticVersion::compare(SemanticVersion::parse(a), SemanticVersion::parse(b)) < 0;
+    });
+
+    // 先解析一次再排序，对应在大目录上反复比较的用法
+    std::vector<SemanticVersion> parsed;
+    parsed.reserve(full.size());
+    for (const std::string& version : full) {
+        parsed.push_back(SemanticVersion::parse(version));
+    }
+    double parsedNs = timeSort(parsed, [](const SemanticVersion& a, const SemanticVersion& b) {
+        return SemanticVersion::compare(a, b) < 0;
+    });
+
+    out << "version-compare, catalog of " << catalogSize << " versions, ns per comparison: "
+        << "legacy split " << legacyNs << ", "
+        << "string_view " << plainNs << ", "
+        << "with pre-release " << fullNs << ", "
+        << "pre-parsed " << parsedNs << Qt::endl;
+
+    QJsonObject entry;
+    entry["scenario"] = "version-compare";
+    entry["catalog_size"] = catalogSize;
+    entry["legacy_ns_per_compare"] = legacyNs;
+    entry["string_view_ns_per_compare"] = plainNs;
+    entry["prerelease_ns_per_compare"] = fullNs;
+    entry["preparsed_ns_per_compare"] = parsedNs;
+    return entry;
+}
@@ -0,0 +1,24 @@
+﻿#pragma once
+
+#include <QJsonObject>
+#include <QTextStream>
+
+
+// ======================
+// 版本号比较微基准
+// ======================
+// 生成一个包含多个渠道（正式、beta、rc、nightly 带构建元数据）的发布目录，
+// 分别用旧的 splitVersion 方式和 SemanticVersion 排序，输出每次比较的平均耗时
+// 旧方式不支持预发布标识，只在去掉预发布和构建元数据的版本号上对比
+QJsonObject runVersionBenchmark(int catalogSize, QTextStream& out);
+
+// ======================
+// 版本号比较的性质检查
+// ======================
+// 用固定种子的随机数生成 samples 组版本号，检查 SemanticVersion::compare：
+//   - 自反、反对称（交换参数结果取反）、传递（a<=b 且 b<=c 时 a<=c）
+//   - 和直接按 SemVer 2.0 规则写的参考实现结果一致，构建元数据不影响结果
+//   - SemanticVersionComparator::isNewer 和 compare 一致
+//   - 只有 主.次.修订 的版本号上和旧的 splitVersion 比较结果一致
+// 结果中 "passed" 为false时基准程序以失败退出，同一个种子总是生成同样的版本号，失败可以复现
+QJsonObject runVersionProperties(int samples, quint32 seed, QTextStream& out);
@@ -0,0 +1,206 @@
+﻿#include "artifactStore.h"
+#include "localIndex.h"
+
+#include <filesystem>
+#include <set>
+#include <system_error>
+
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+
+#include <QDebug>
+
+namespace fs = std::filesystem;
+
+
+// QString 路径转 std::filesystem::path，走宽字符避免中文路径在 Windows 上乱码
+static fs::path toFsPath(const QString& path) {
+    return fs::path(path.toStdWString());
+}
+
+ArtifactStore::ArtifactStore(const QString& rootPath, int keepVersions)
+    : rootPath(rootPath), keepVersions(qMax(1, keepVersions))
+{
+}
+
+bool ArtifactStore::contains(const std::string& hash) const {
+    return !hash.empty() && QFileInfo::exists(objectPath(hash));
+}
+
+bool ArtifactStore::verifyObject(const std::string& hash) {
+    if (!contains(hash)) {
+        return false;
+    }
+    QString object = objectPath(hash);
+    if (LocalFileIndex::computeHash(object).compare(QString::fromStdString(hash), Qt::CaseInsensitive) == 0) {
+        return true;
+    }
+    // 只删除仓库里的这个链接，安装目录中的文件由调用方重新放置
+    qDebug() << "Store object corrupted, dropped: " << object;
+    QFile::remove(object);
+    return false;
+}
+
+QString ArtifactStore::objectPath(const std::string& hash) const {
+    QString h = QString::fromStdString(hash);
+    return rootPath + "/objects/" + h.left(2) + "/" + h;
+}
+
+bool ArtifactStore::moveIn(const QString& path, const std::string& hash) {
+    QString object = objectPath(hash);
+    if (QFileInfo::exists(object)) {
+        // 同样内容的对象已经在仓库里了
+        QFile::remove(path);
+        return true;
+    }
+    QDir().mkpath(QFileInfo(object).path());
+
+    std::error_code ec;
+    fs::rename(toFsPath(path), toFsPath(object), ec);
+    if (ec) {
+        qDebug() << "Failed to move file into store: " << path << QString::fromStdString(ec.message());
+        return false;
+    }
+    return true;
+}
+
+bool ArtifactStore::linkIn(const QString& path, const std::string& hash) {
+    if (hash.empty() || !QFileInfo::exists(path)) {
+        return false;
+    }
+    QString object = objectPath(hash);
+    if (QFileInfo::exists(object)) {
+        return true;
+    }
+    QDir().mkpath(QFileInfo(object).path());
+    return linkOrCopy(path, object);
+}
+
+bool ArtifactStore::place(const std::string& hash, const QString& targetPath) {
+    QString object = objectPath(hash);
+    if (!QFileInfo::exists(object)) {
+        qDebug() << "Store object missing: " << QString::fromStdString(hash);
+        return false;
+    }
+
+    // 先在目标旁边建好，再一次 rename 覆盖目标
+    QString staging = targetPath + ".store";
+    QFile::remove(staging);
+    QString targetDir = QFileInfo(targetPath).path();
+    if (!targetDir.isEmpty()) {
+        QDir().mkpath(targetDir);
+    }
+    if (!linkOrCopy(object, staging)) {
+        return false;
+    }
+
+    std::error_code ec;
+    fs::rename(toFsPath(staging), toFsPath(targetPath), ec);
+    if (ec) {
+        qDebug() << "Failed to place file from store: " << targetPath << QString::fromStdString(ec.message());
+        QFile::remove(staging);
+        return false;
+    }
+    return true;
+}
+
+void ArtifactStore::recordVersions(const std::vector<std::pair<int, Snapshot>>& records) {
+    std::vector<std::pair<int, Snapshot>> versions = loadVersions();
+
+    // 同一版本只保留最新的记录，新记录放在最前面
+    for (const auto& record : records) {
+        for (auto it = versions.begin(); it != versions.end(); ++it) {
+            if (it->first == record.first) {
+                versions.erase(it);
+                break;
+            }
+        }
+        versions.insert(versions.begin(), record);
+    }
+    if (static_cast<int>(versions.size()) > keepVersions) {
+        versions.resize(keepVersions);
+    }
+
+    saveVersions(versions);
+    prune(versions);
+}
+
+bool ArtifactStore::linkOrCopy(const QString& from, const QString& to) {
+    // 优先硬链接：不复制数据，瞬间完成
+    std::error_code ec;
+    fs::create_hard_link(toFsPath(from), toFsPath(to), ec);
+    if (!ec) {
+        return true;
+    }
+
+    // 跨卷或文件系统不支持硬链接时退回复制
+    if (!QFile::copy(from, to)) {
+        qDebug() << "Failed to link or copy: " << from << " -> " << to;
+        return false;
+    }
+    return true;
+}
+
+void ArtifactStore::prune(const std::vector<std::pair<int, Snapshot>>& versions) {
+    std::set<QString> referenced;
+    for (const auto& version : versions) {
+        for (const auto& file : version.second) {
+            referenced.insert(QString::fromStdString(file.second));
+        }
+    }
+
+    QDirIterator it(rootPath + "/objects", QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        QString path = it.next();
+        if (referenced.count(it.fileName()) == 0) {
+            QFile::remove(path);
+        }
+    }
+}
+
+std::vector<std::pair<int, ArtifactStore::Snapshot>> ArtifactStore::loadVersions() const {
+    std::vector<std::pair<int, Snapshot>> versions;
+    QFile file(rootPath + "/versions.json");
+    if (!file.open(QIODevice::ReadOnly)) {
+        return versions;
+    }
+
+    for (const auto& item : QJsonDocument::fromJson(file.readAll()).array()) {
+        QJsonObject obj = item.toObject();
+        Snapshot snapshot;
+        QJsonObject files = obj["files"].toObject();
+        for (auto it = files.begin(); it != files.end(); ++it) {
+            snapshot[it.key().toStdString()] = it.value().toString().toStdString();
+        }
+        versions.push_back({ obj["version"].toInt(), snapshot });
+    }
+    return versions;
+}
+
+void ArtifactStore::saveVersions(const std::vector<std::pair<int, Snapshot>>& versions) const {
+    QJsonArray array;
+    for (const auto& version : versions) {
+        QJsonObject files;
+        for (const auto& file : version.second) {
+            files[QString::fromStdString(file.first)] = QString::fromStdString(file.second);
+        }
+        QJsonObject obj;
+        obj["version"] = version.first;
+        obj["files"] = files;
+        array.append(obj);
+    }
+
+    // 整体替换，中途断电时保留原来的文件
+    QDir().mkpath(rootPath);
+    QSaveFile file(rootPath + "/versions.json");
+    if (file.open(QIODevice::WriteOnly)) {
+        file.write(QJsonDocument(array).toJson(QJsonDocument::Compact));
+        file.commit();
+    }
+}
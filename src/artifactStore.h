@@ -0,0 +1,50 @@
+﻿#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <QString>
+
+
+// ======================
+// 本地内容寻址仓库
+// ======================
+// 按文件哈希保存热更新文件的各个版本：.store/objects/<哈希前两位>/<哈希>
+// 安装目录中的文件通过硬链接从仓库放置（不支持硬链接时退回复制），
+// 因此保存历史版本几乎不占额外的写入，回滚到仓库里有的版本也不需要网络
+// .store/versions.json 记录最近几个热更新版本各自的 (文件名 -> 哈希)，
+// 不被任何保留版本引用的对象会被清理
+class ArtifactStore {
+public:
+    // 文件名 -> 哈希
+    using Snapshot = std::map<std::string, std::string>;
+
+    ArtifactStore(const QString& rootPath, int keepVersions);
+
+    bool contains(const std::string& hash) const;
+    // 重新计算对象的哈希，和名字不一致时删除对象（硬链接的安装文件被就地改坏时仓库对象也一起坏了）
+    bool verifyObject(const std::string& hash);
+    QString objectPath(const std::string& hash) const;
+
+    // 把已校验的文件移入仓库（下载完成的 .tmp 文件），成功后原路径不再存在
+    bool moveIn(const QString& path, const std::string& hash);
+    // 把安装目录中即将被替换的文件链接进仓库，保留旧版本用于回滚，原文件不动
+    bool linkIn(const QString& path, const std::string& hash);
+
+    // 用仓库中的对象替换 targetPath，替换是一次 rename，不会出现写了一半的文件
+    bool place(const std::string& hash, const QString& targetPath);
+
+    // 记录若干热更新版本的完整文件列表（后面的更新），一次写入后清理不再被引用的旧对象
+    // 必须一起记录：分开记录时，记第一个版本后的清理会删掉还没记录的版本的对象
+    void recordVersions(const std::vector<std::pair<int, Snapshot>>& records);
+
+private:
+    bool linkOrCopy(const QString& from, const QString& to);
+    void prune(const std::vector<std::pair<int, Snapshot>>& versions);
+    std::vector<std::pair<int, Snapshot>> loadVersions() const;
+    void saveVersions(const std::vector<std::pair<int, Snapshot>>& versions) const;
+
+    QString rootPath;
+    int keepVersions;
+};
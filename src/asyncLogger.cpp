@@ -0,0 +1,194 @@
+﻿#include "asyncLogger.h"
+
+#include <csignal>
+
+#include <QThread>
+#include <QFileInfo>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#endif
+
+
+AsyncLogger::~AsyncLogger() {
+    stop();
+}
+
+bool AsyncLogger::start(const QString& path, qint64 maxBytes, int keepFiles) {
+    QMutexLocker fileLocker(&fileMutex);
+    if (running) {
+        return true;
+    }
+    this->maxBytes = maxBytes;
+    this->keepFiles = keepFiles;
+    file.setFileName(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        return false;
+    }
+    if (file.size() >= maxBytes) {
+        rotate();
+    }
+
+    {
+        QMutexLocker locker(&queueMutex);
+        running = true;
+        stopping = false;
+    }
+    writer = QThread::create([this]() { run(); });
+    writer->start(QThread::LowPriority);
+    installCrashHandlers();
+    return true;
+}
+
+void AsyncLogger::stop() {
+    {
+        QMutexLocker locker(&queueMutex);
+        if (!running) {
+            return;
+        }
+        stopping = true;
+        wakeUp.wakeOne();
+    }
+    writer->wait();
+    delete writer;
+    writer = nullptr;
+
+    QMutexLocker fileLocker(&fileMutex);
+    file.close();
+}
+
+void AsyncLogger::log(const QString& line) {
+    QMutexLocker locker(&queueMutex);
+    if (!running || stopping) {
+        return;
+    }
+    if (static_cast<int>(pending.size()) >= MAX_PENDING) {
+        ++dropped;
+        return;
+    }
+    pending.push_back(line);
+    // 写线程忙的时候新日志会攒成一批，只在队列从空变为非空时唤醒
+    if (pending.size() == 1) {
+        wakeUp.wakeOne();
+    }
+}
+
+void AsyncLogger::flush() {
+    std::vector<QString> batch;
+    QMutexLocker fileLocker(&fileMutex);
+    {
+        QMutexLocker locker(&queueMutex);
+        batch.swap(pending);
+    }
+    writeBatch(batch);
+}
+
+void AsyncLogger::run() {
+    std::vector<QString> batch;
+    for (;;) {
+        {
+            QMutexLocker locker(&queueMutex);
+            while (pending.empty() && !stopping) {
+                wakeUp.wait(&queueMutex);
+            }
+            if (pending.empty() && stopping) {
+                running = false;
+                return;
+            }
+            batch.swap(pending);
+        }
+        QMutexLocker fileLocker(&fileMutex);
+        writeBatch(batch);
+        batch.clear();
+    }
+}
+
+// 调用方持有 fileMutex
+void AsyncLogger::writeBatch(std::vector<QString>& batch) {
+    if (!file.isOpen()) {
+        return;
+    }
+
+    QByteArray bytes;
+    qint64 droppedLines = dropped.exchange(0);
+    if (droppedLines > 0) {
+        bytes += "[logger] " + QByteArray::number(droppedLines) + " lines dropped\n";
+    }
+    for (const QString& line : batch) {
+        bytes += line.toUtf8();
+        bytes += '\n';
+    }
+    if (bytes.isEmpty()) {
+        return;
+    }
+    file.write(bytes);
+    file.flush();
+
+    if (file.size() >= maxBytes) {
+        rotate();
+    }
+}
+
+// 调用方持有 fileMutex
+void AsyncLogger::rotate() {
+    QString path = file.fileName();
+    file.close();
+    QFile::remove(path + "." + QString::number(keepFiles));
+    for (int i = keepFiles - 1; i >= 1; --i) {
+        QFile::rename(path + "." + QString::number(i), path + "." + QString::number(i + 1));
+    }
+    if (keepFiles > 0) {
+        QFile::rename(path, path + "." + QString::number(1));
+    }
+    else {
+        QFile::remove(path);
+    }
+    file.open(QIODevice::WriteOnly | QIODevice::Append);
+}
+
+void AsyncLogger::flushOnCrash(const QString& reason) {
+    if (!fileMutex.tryLock()) {
+        return;
+    }
+    std::vector<QString> batch;
+    if (queueMutex.tryLock()) {
+        batch.swap(pending);
+        queueMutex.unlock();
+    }
+    batch.push_back(reason);
+    writeBatch(batch);
+    fileMutex.unlock();
+}
+
+void AsyncLogger::messageHandler(QtMsgType type, const QMessageLogContext&, const QString& msg) {
+    AsyncLogger& logger = getInstance();
+    logger.log(msg);
+    if (type == QtFatalMsg) {
+        // qFatal 之后进程会立即 abort，先把日志写完
+        logger.flush();
+    }
+}
+
+static void crashSignalHandler(int signal) {
+    AsyncLogger::getInstance().flushOnCrash(QString("Fatal signal: %1").arg(signal));
+    std::signal(signal, SIG_DFL);
+    std::raise(signal);
+}
+
+#ifdef Q_OS_WIN
+static LONG WINAPI crashExceptionFilter(EXCEPTION_POINTERS* info) {
+    AsyncLogger::getInstance().flushOnCrash(QString("Unhandled exception: 0x%1")
+        .arg(static_cast<quint32>(info->ExceptionRecord->ExceptionCode), 8, 16, QChar('0')));
+    return EXCEPTION_CONTINUE_SEARCH;
+}
+#endif
+
+void AsyncLogger::installCrashHandlers() {
+    std::signal(SIGABRT, crashSignalHandler);
+    std::signal(SIGSEGV, crashSignalHandler);
+    std::signal(SIGFPE, crashSignalHandler);
+    std::signal(SIGILL, crashSignalHandler);
+#ifdef Q_OS_WIN
+    SetUnhandledExceptionFilter(crashExceptionFilter);
+#endif
+}
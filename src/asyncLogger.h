@@ -0,0 +1,69 @@
+﻿#pragma once
+
+#include <vector>
+#include <atomic>
+
+#include <QString>
+#include <QFile>
+#include <QMutex>
+#include <QWaitCondition>
+
+class QThread;
+
+
+// ======================
+// 异步日志
+// ======================
+// 替代原来每条日志都加锁、打开文件、写一行、关闭文件的做法：
+// 调用线程只把日志放进内存队列（短暂加锁、不做IO），后台写线程批量写入并保持文件常开，
+// 文件超过上限时轮转为 updater.log.1 ~ updater.log.<keepFiles>
+// 程序正常退出时调用 stop() 写完剩余日志；qFatal 和崩溃时尽力同步写出
+class AsyncLogger {
+public:
+    static AsyncLogger& getInstance() {
+        static AsyncLogger instance;
+        return instance;
+    }
+
+    // 打开日志文件并启动写线程
+    bool start(const QString& path = "updater.log", qint64 maxBytes = 5 * 1024 * 1024, int keepFiles = 3);
+    // 写出剩余日志并结束写线程，之后的日志直接丢弃
+    void stop();
+
+    // 放入队列，不等待写盘
+    void log(const QString& line);
+    // 同步写出队列中的全部日志
+    void flush();
+    // 崩溃时调用：附加一行原因并尽力写出，拿不到锁就放弃，避免在信号处理中死锁
+    void flushOnCrash(const QString& reason);
+
+    // 供 qInstallMessageHandler 使用
+    static void messageHandler(QtMsgType type, const QMessageLogContext& context, const QString& msg);
+
+private:
+    AsyncLogger() = default;
+    ~AsyncLogger();
+
+    void run();
+    void writeBatch(std::vector<QString>& batch);
+    void rotate();
+    static void installCrashHandlers();
+
+    // 队列超过这个条数时丢弃新日志，写盘跟不上时不让内存无限增长
+    static constexpr int MAX_PENDING = 100000;
+
+    QMutex queueMutex;
+    QWaitCondition wakeUp;
+    std::vector<QString> pending;
+    std::atomic<qint64> dropped{ 0 };
+    bool running = false;
+    bool stopping = false;
+
+    // 写文件只在写线程里进行，flush() 和崩溃时的写出也要持有该锁
+    QMutex fileMutex;
+    QFile file;
+    qint64 maxBytes = 0;
+    int keepFiles = 0;
+
+    QThread* writer = nullptr;
+};
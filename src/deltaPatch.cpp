@@ -0,0 +1,194 @@
+﻿#include "deltaPatch.h"
+
+#include <cstring>
+
+#include <QtEndian>
+
+#include <QDebug>
+
+
+static const char PATCH_MAGIC[4] = { 'U', 'P', 'D', 'P' };
+static const quint8 PATCH_VERSION = 1;
+static const int HEADER_SIZE = 4 + 1 + 8 + 8 + 16 + 16;
+static const quint8 OP_COPY = 0x01;
+static const quint8 OP_ADD = 0x02;
+
+// COPY 指令从旧文件分块读取，避免大段拷贝一次性读入内存
+static const qint64 COPY_CHUNK_SIZE = 64 * 1024;
+
+DeltaPatcher::DeltaPatcher(const QString& basePath, const QString& baseHash, OutputHandler output)
+    : base(basePath), baseHash(baseHash), output(std::move(output))
+{
+}
+
+bool DeltaPatcher::feed(const char* data, qint64 size) {
+    while (size > 0) {
+        switch (state) {
+        case State::Header:
+            if (!collect(data, size, HEADER_SIZE)) {
+                return true;
+            }
+            if (!parseHeader()) {
+                return false;
+            }
+            state = produced < newSize ? State::Opcode : State::Done;
+            break;
+
+        case State::Opcode: {
+            quint8 op = static_cast<quint8>(*data);
+            ++data;
+            --size;
+            if (op == OP_COPY) {
+                state = State::CopyArgs;
+            }
+            else if (op == OP_ADD) {
+                state = State::AddLength;
+            }
+            else {
+                return fail(QString("unknown patch opcode: %1").arg(op));
+            }
+            break;
+        }
+
+        case State::CopyArgs: {
+            if (!collect(data, size, 8 + 4)) {
+                return true;
+            }
+            const uchar* args = reinterpret_cast<const uchar*>(field.constData());
+            quint64 offset = qFromLittleEndian<quint64>(args);
+            quint32 length = qFromLittleEndian<quint32>(args + 8);
+            field.clear();
+            if (!copyFromBase(offset, length)) {
+                return false;
+            }
+            state = produced < newSize ? State::Opcode : State::Done;
+            break;
+        }
+
+        case State::AddLength:
+            if (!collect(data, size, 4)) {
+                return true;
+            }
+            addRemaining = qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(field.constData()));
+            field.clear();
+            if (produced + addRemaining > newSize) {
+                return fail("ADD exceeds target size");
+            }
+            state = addRemaining > 0 ? State::AddData : (produced < newSize ? State::Opcode : State::Done);
+            break;
+
+        case State::AddData: {
+            // ADD 的数据直接透传给输出，不做缓冲
+            qint64 take = qMin<qint64>(size, addRemaining);
+            if (!emitOutput(data, take)) {
+                return false;
+            }
+            data += take;
+            size -= take;
+            addRemaining -= static_cast<quint32>(take);
+            if (addRemaining == 0) {
+                state = produced < newSize ? State::Opcode : State::Done;
+            }
+            break;
+        }
+
+        case State::Done:
+            return fail("trailing data after end of patch");
+
+        case State::Failed:
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DeltaPatcher::finish() {
+    base.close();
+    if (state == State::Failed) {
+        return false;
+    }
+    if (state != State::Done || produced != newSize) {
+        return fail(QString("patch truncated, produced %1 of %2 bytes").arg(produced).arg(newSize));
+    }
+    return true;
+}
+
+QString DeltaPatcher::errorString() const {
+    return error;
+}
+
+bool DeltaPatcher::collect(const char*& data, qint64& size, int needed) {
+    qint64 take = qMin<qint64>(size, needed - field.size());
+    field.append(data, static_cast<int>(take));
+    data += take;
+    size -= take;
+    return field.size() == needed;
+}
+
+bool DeltaPatcher::parseHeader() {
+    const uchar* header = reinterpret_cast<const uchar*>(field.constData());
+    if (memcmp(header, PATCH_MAGIC, sizeof(PATCH_MAGIC)) != 0) {
+        return fail("bad patch magic");
+    }
+    if (header[4] != PATCH_VERSION) {
+        return fail(QString("unsupported patch version: %1").arg(header[4]));
+    }
+    quint64 oldSize = qFromLittleEndian<quint64>(header + 5);
+    newSize = qFromLittleEndian<quint64>(header + 13);
+    QString oldHash = QByteArray(field.constData() + 21, 16).toHex();
+    // 新文件MD5不在这里检查，调用方对产生的内容计算哈希，和版本信息里的哈希比较
+    field.clear();
+
+    // 补丁必须正好是基于本地这个旧文件生成的
+    if (oldHash != baseHash) {
+        return fail("patch base hash does not match local file");
+    }
+    if (!base.open(QIODevice::ReadOnly)) {
+        return fail("cannot open base file: " + base.fileName());
+    }
+    if (static_cast<quint64>(base.size()) != oldSize) {
+        return fail("base file size does not match patch");
+    }
+    return true;
+}
+
+bool DeltaPatcher::copyFromBase(quint64 offset, quint32 length) {
+    if (offset + length > static_cast<quint64>(base.size())) {
+        return fail("COPY out of base file range");
+    }
+    if (produced + length > newSize) {
+        return fail("COPY exceeds target size");
+    }
+    if (!base.seek(static_cast<qint64>(offset))) {
+        return fail("seek failed in base file");
+    }
+
+    QByteArray buffer;
+    qint64 remaining = length;
+    while (remaining > 0) {
+        buffer = base.read(qMin(remaining, COPY_CHUNK_SIZE));
+        if (buffer.isEmpty()) {
+            return fail("read failed in base file");
+        }
+        if (!emitOutput(buffer.constData(), buffer.size())) {
+            return false;
+        }
+        remaining -= buffer.size();
+    }
+    return true;
+}
+
+bool DeltaPatcher::emitOutput(const char* data, qint64 size) {
+    if (!output(data, size)) {
+        return fail("failed to write patched output");
+    }
+    produced += size;
+    return true;
+}
+
+bool DeltaPatcher::fail(const QString& message) {
+    state = State::Failed;
+    error = message;
+    qDebug() << "Delta patch failed: " << message;
+    return false;
+}
@@ -0,0 +1,63 @@
+﻿#pragma once
+
+#include <functional>
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+
+// ======================
+// 二进制差分补丁
+// ======================
+// 服务器为 (旧文件哈希, 新文件哈希) 发布差分补丁，客户端用本地旧文件 + 补丁重建新文件
+// 补丁格式（整数均为小端）：
+//   头部：   "UPDP" | u8 版本(=1) | u64 旧文件大小 | u64 新文件大小 | 16B 旧文件MD5 | 16B 新文件MD5
+//   指令流： u8 0x01 COPY | u64 旧文件偏移 | u32 长度      —— 从旧文件拷贝一段
+//            u8 0x02 ADD  | u32 长度 | <长度字节的数据>  —— 直接写入补丁中的数据
+// 指令按顺序产生新文件，产生的字节数达到新文件大小时结束
+// DeltaPatcher 以流的方式应用补丁：补丁数据边下载边喂进来，输出边产生边交给 output，
+// 补丁和新文件都不需要整体放在内存里
+class DeltaPatcher {
+public:
+    using OutputHandler = std::function<bool(const char* data, qint64 size)>;
+
+    DeltaPatcher(const QString& basePath, const QString& baseHash, OutputHandler output);
+
+    // 喂入一段补丁数据，返回false表示补丁格式错误、与本地旧文件不匹配或输出失败
+    bool feed(const char* data, qint64 size);
+
+    // 补丁数据全部喂完后调用，检查新文件是否已完整产生
+    bool finish();
+
+    QString errorString() const;
+
+private:
+    enum class State {
+        Header,
+        Opcode,
+        CopyArgs,
+        AddLength,
+        AddData,
+        Done,
+        Failed
+    };
+
+    // 攒够 size 字节的定长字段后返回true
+    bool collect(const char*& data, qint64& size, int needed);
+    bool parseHeader();
+    bool copyFromBase(quint64 offset, quint32 length);
+    bool emitOutput(const char* data, qint64 size);
+    bool fail(const QString& message);
+
+    QFile base;
+    QString baseHash;
+    OutputHandler output;
+
+    State state = State::Header;
+    QByteArray field;
+    quint64 newSize = 0;
+    quint64 produced = 0;
+    quint32 addRemaining = 0;
+    QString error;
+};
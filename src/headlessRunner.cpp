@@ -0,0 +1,101 @@
+﻿#include "headlessRunner.h"
+#include "updater.h"
+
+#include <QCoreApplication>
+#include <QProcess>
+
+#include <QDebug>
+
+
+HeadlessRunner::HeadlessRunner(Mode mode, bool verify, QObject* parent)
+    : QObject(parent), mode(mode), out(stdout)
+{
+    // 没有界面线程需要保持响应，Updater 直接在主线程的事件循环里运行
+    // 先启动模式只把更新准备好、留到下次启动时提交，命令行下没有"下次启动"，总是直接应用
+    UpdaterConfig config = UpdaterConfig::load();
+    config.launchFirst = false;
+    updater = new Updater(std::make_unique<SemanticVersionComparator>(), config, this);
+    updater->setCheckOnly(mode == Mode::CheckOnly);
+    updater->setVerify(verify);
+
+    connect(updater, &Updater::progressChanged, this, &HeadlessRunner::onProgress);
+    connect(updater, &Updater::updateAvailable, this, &HeadlessRunner::onUpdateAvailable);
+    connect(updater, &Updater::fileCorrupted, this, &HeadlessRunner::onFileCorrupted);
+    connect(updater, &Updater::launchProgramRequested, this, &HeadlessRunner::onLaunchProgram);
+    connect(updater, &Updater::launchInstallerRequested, this, &HeadlessRunner::onLaunchInstaller);
+    connect(updater, &Updater::finished, this, &HeadlessRunner::onFinished);
+}
+
+void HeadlessRunner::start() {
+    updater->process();
+}
+
+void HeadlessRunner::onProgress(int value, const QString& text) {
+    emitLine({ "progress", QString::number(value), text });
+}
+
+void HeadlessRunner::onUpdateAvailable(const QString& kind, const QString& version) {
+    updateAvailable = true;
+    emitLine({ "available", kind, version });
+}
+
+void HeadlessRunner::onFileCorrupted(const QString& path) {
+    emitLine({ "corrupt", path });
+}
+
+void HeadlessRunner::onLaunchProgram(const QString& programPath) {
+    if (mode != Mode::Run) {
+        return;
+    }
+    emitLine({ "launch", "program", programPath });
+    if (!QProcess::startDetached(programPath, QStringList())) {
+        qDebug() << "Failed to launch main program: " << programPath;
+        launchFailed = true;
+    }
+}
+
+void HeadlessRunner::onLaunchInstaller(const QString& installerPath) {
+    if (mode != Mode::Run) {
+        installerReady = true;
+        emitLine({ "installer", installerPath });
+        return;
+    }
+    emitLine({ "launch", "installer", installerPath });
+    if (!QProcess::startDetached(installerPath, QStringList())) {
+        qDebug() << "Failed to launch installer: " << installerPath;
+        launchFailed = true;
+    }
+}
+
+void HeadlessRunner::onFinished(bool success, const QString& message) {
+    emitLine({ "result", success ? "ok" : "error", message });
+
+    int code = ExitOk;
+    if (!success) {
+        code = ExitFailed;
+    }
+    else if (launchFailed) {
+        code = ExitLaunchFailed;
+    }
+    else if (updateAvailable && mode == Mode::CheckOnly) {
+        code = ExitUpdateAvailable;
+    }
+    else if (installerReady) {
+        code = ExitInstallerReady;
+    }
+    qDebug() << "Headless update finished, exit code: " << code;
+
+    // 在 process() 里同步结束时事件循环还没开始，延后到事件循环中退出
+    QMetaObject::invokeMethod(QCoreApplication::instance(), [code]() {
+        QCoreApplication::exit(code);
+    }, Qt::QueuedConnection);
+}
+
+void HeadlessRunner::emitLine(const QStringList& fields) {
+    // 字段中的制表符和换行替换成空格，保证一条记录一行
+    QStringList cleaned;
+    for (QString field : fields) {
+        cleaned.append(field.replace('\t', ' ').replace('\n', ' '));
+    }
+    out << cleaned.join('\t') << Qt::endl;
+}
@@ -0,0 +1,62 @@
+﻿#pragma once
+
+#include <QObject>
+#include <QTextStream>
+
+class Updater;
+
+
+// ======================
+// 无界面运行
+// ======================
+// 在 QCoreApplication 上直接运行 Updater，不加载任何界面组件，供部署脚本和无人值守的机器使用
+// 进度和结果按行输出到标准输出，每行是以制表符分隔的字段，第一个字段是类型：
+//   progress    <百分比>    <说明>
+//   available   <hotfix|installer|repair>    <版本>
+//   corrupt     <路径>                  （--verify 模式下缺失或损坏的文件）
+//   launch      <program|installer>    <路径>
+//   installer   <路径>                  （--apply 模式下安装包已就绪但未运行）
+//   result      <ok|error>    <说明>
+class HeadlessRunner : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum class Mode {
+        Run,        // --headless：和界面模式一样检查、更新并启动主程序或安装包
+        CheckOnly,  // --check-only：只检查，不下载也不修改任何文件
+        Apply,      // --apply：检查并应用热更新/下载安装包，但不启动任何程序
+    };
+
+    // 进程退出码
+    enum ExitCode {
+        ExitOk = 0,                 // 已是最新或更新完成
+        ExitFailed = 1,             // 更新失败
+        ExitUpdateAvailable = 2,    // --check-only：有可用更新
+        ExitInstallerReady = 3,     // --apply：安装包已下载校验，需要运行安装包完成更新
+        ExitLaunchFailed = 4,       // 更新完成但启动主程序或安装包失败
+    };
+
+    // verify 为true时先并行校验所有本地文件（--verify），损坏的文件随热更新流程一起修复
+    HeadlessRunner(Mode mode, bool verify, QObject* parent = nullptr);
+
+    // 开始更新，结束时以对应的退出码退出事件循环
+    void start();
+
+private:
+    void onProgress(int value, const QString& text);
+    void onUpdateAvailable(const QString& kind, const QString& version);
+    void onFileCorrupted(const QString& path);
+    void onLaunchProgram(const QString& programPath);
+    void onLaunchInstaller(const QString& installerPath);
+    void onFinished(bool success, const QString& message);
+
+    void emitLine(const QStringList& fields);
+
+    Mode mode;
+    Updater* updater;
+    QTextStream out;
+    bool updateAvailable = false;
+    bool installerReady = false;
+    bool launchFailed = false;
+};
@@ -0,0 +1,191 @@
+﻿#include "hotfixBundle.h"
+
+#include <cstring>
+
+#include <QtEndian>
+
+#include <QDebug>
+
+
+static const char BUNDLE_MAGIC[4] = { 'U', 'P', 'D', 'B' };
+static const quint8 BUNDLE_VERSION = 1;
+static const int HEADER_SIZE = 4 + 1 + 4 + 4;
+// 索引的上限，防止损坏的头部让客户端分配过大的内存
+static const quint32 MAX_INDEX_SIZE = 16 * 1024 * 1024;
+// 索引中一个条目至少占的字节数：名称长度 + 大小 + MD5（名称为空时）
+static const quint32 MIN_INDEX_ENTRY_SIZE = 2 + 8 + 16;
+
+HotfixBundleReader::HotfixBundleReader(EntryBeginHandler onBegin, EntryDataHandler onData, EntryEndHandler onEnd)
+    : onBegin(std::move(onBegin)), onData(std::move(onData)), onEnd(std::move(onEnd))
+{
+}
+
+bool HotfixBundleReader::feed(const char* data, qint64 size) {
+    while (size > 0) {
+        switch (state) {
+        case State::Header:
+            if (!collect(data, size, HEADER_SIZE)) {
+                return true;
+            }
+            if (!parseHeader()) {
+                return false;
+            }
+            if (indexSize == 0 && (!parseIndex() || !nextEntry())) {
+                return false;
+            }
+            break;
+
+        case State::Index:
+            if (!collect(data, size, static_cast<int>(indexSize))) {
+                return true;
+            }
+            if (!parseIndex() || !nextEntry()) {
+                return false;
+            }
+            break;
+
+        case State::EntryData: {
+            // 条目数据直接透传，不做缓冲
+            qint64 take = static_cast<qint64>(qMin<quint64>(static_cast<quint64>(size), remaining));
+            if (extracting) {
+                hasher.addData(data, static_cast<int>(take));
+                if (!onData(data, take)) {
+                    return fail("failed to write entry: " + entries[current].name);
+                }
+            }
+            data += take;
+            size -= take;
+            remaining -= static_cast<quint64>(take);
+            if (remaining == 0 && (!endEntry() || !nextEntry())) {
+                return false;
+            }
+            break;
+        }
+
+        case State::Done:
+            return fail("trailing data after end of bundle");
+
+        case State::Failed:
+            return false;
+        }
+    }
+    return true;
+}
+
+bool HotfixBundleReader::finish() {
+    if (state == State::Failed) {
+        return false;
+    }
+    if (state != State::Done) {
+        return fail(QString("bundle truncated, %1 of %2 entries read").arg(current).arg(entryCount));
+    }
+    return true;
+}
+
+QString HotfixBundleReader::errorString() const {
+    return error;
+}
+
+bool HotfixBundleReader::collect(const char*& data, qint64& size, int needed) {
+    qint64 take = qMin<qint64>(size, needed - field.size());
+    field.append(data, static_cast<int>(take));
+    data += take;
+    size -= take;
+    return field.size() == needed;
+}
+
+bool HotfixBundleReader::parseHeader() {
+    const uchar* header = reinterpret_cast<const uchar*>(field.constData());
+    if (memcmp(header, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC)) != 0) {
+        return fail("bad bundle magic");
+    }
+    if (header[4] != BUNDLE_VERSION) {
+        return fail(QString("unsupported bundle version: %1").arg(header[4]));
+    }
+    entryCount = qFromLittleEndian<quint32>(header + 5);
+    indexSize = qFromLittleEndian<quint32>(header + 9);
+    field.clear();
+    if (indexSize > MAX_INDEX_SIZE) {
+        return fail(QString("bundle index too large: %1").arg(indexSize));
+    }
+    // 条目数来自不可信的头部，按索引大小检查后才能据此分配内存
+    if (entryCount > indexSize / MIN_INDEX_ENTRY_SIZE) {
+        return fail(QString("bundle entry count %1 does not fit index of %2 bytes").arg(entryCount).arg(indexSize));
+    }
+    state = State::Index;
+    return true;
+}
+
+bool HotfixBundleReader::parseIndex() {
+    const uchar* index = reinterpret_cast<const uchar*>(field.constData());
+    const quint32 end = static_cast<quint32>(field.size());
+    quint32 pos = 0;
+
+    entries.clear();
+    entries.reserve(entryCount);
+    for (quint32 i = 0; i < entryCount; ++i) {
+        if (end - pos < 2) {
+            return fail("bundle index truncated");
+        }
+        quint16 nameLength = qFromLittleEndian<quint16>(index + pos);
+        pos += 2;
+        if (end - pos < static_cast<quint32>(nameLength) + 8 + 16) {
+            return fail("bundle index truncated");
+        }
+        Entry entry;
+        entry.name = QString::fromUtf8(field.constData() + pos, nameLength);
+        pos += nameLength;
+        entry.size = qFromLittleEndian<quint64>(index + pos);
+        pos += 8;
+        entry.hash = QByteArray(field.constData() + pos, 16).toHex();
+        pos += 16;
+        entries.push_back(entry);
+    }
+    if (pos != end) {
+        return fail("bundle index size mismatch");
+    }
+    field.clear();
+    current = 0;
+    return true;
+}
+
+bool HotfixBundleReader::nextEntry() {
+    while (current < entries.size()) {
+        const Entry& entry = entries[current];
+        extracting = onBegin(entry);
+        hasher.reset();
+        remaining = entry.size;
+        if (remaining > 0) {
+            state = State::EntryData;
+            return true;
+        }
+        if (!endEntry()) {
+            return false;
+        }
+    }
+    state = State::Done;
+    return true;
+}
+
+bool HotfixBundleReader::endEntry() {
+    const Entry& entry = entries[current];
+    if (extracting) {
+        QString actual = hasher.result().toHex();
+        if (actual != entry.hash) {
+            return fail(QString("hash mismatch for bundle entry %1: expected %2, got %3")
+                .arg(entry.name, entry.hash, actual));
+        }
+        if (!onEnd(entry)) {
+            return fail("failed to finish entry: " + entry.name);
+        }
+    }
+    ++current;
+    return true;
+}
+
+bool HotfixBundleReader::fail(const QString& message) {
+    state = State::Failed;
+    error = message;
+    qDebug() << "Hotfix bundle failed: " << message;
+    return false;
+}
@@ -0,0 +1,76 @@
+﻿#pragma once
+
+#include <functional>
+#include <vector>
+
+#include <QByteArray>
+#include <QString>
+#include <QCryptographicHash>
+
+
+// ======================
+// 热更新打包文件
+// ======================
+// 服务器可以把一个热更新版本的全部文件打成一个包发布，客户端一次请求流式下载，边收边解出每个文件，
+// 代替几百个单独的小文件请求
+// 打包格式（整数均为小端）：
+//   头部：   "UPDB" | u8 版本(=1) | u32 条目数 | u32 索引字节数
+//   索引：   每个条目 u16 名称长度 | 名称(UTF-8) | u64 大小 | 16B MD5
+//   数据：   按索引顺序依次排列的各条目内容
+// 索引在最前面，读完索引就知道后面每个条目的大小和哈希，不需要缓冲整个包
+class HotfixBundleReader {
+public:
+    struct Entry {
+        QString name;
+        quint64 size = 0;
+        QString hash;   // MD5 hex
+    };
+
+    // 条目开始，返回false表示跳过该条目（数据照常读过，但不交给 EntryDataHandler）
+    using EntryBeginHandler = std::function<bool(const Entry& entry)>;
+    using EntryDataHandler = std::function<bool(const char* data, qint64 size)>;
+    // 解出的条目结束，此时数据已经和索引中的哈希比对通过；返回false表示处理失败
+    using EntryEndHandler = std::function<bool(const Entry& entry)>;
+
+    HotfixBundleReader(EntryBeginHandler onBegin, EntryDataHandler onData, EntryEndHandler onEnd);
+
+    // 喂入一段打包数据，返回false表示格式错误、条目校验失败或处理失败
+    bool feed(const char* data, qint64 size);
+
+    // 数据全部喂完后调用，检查所有条目是否都已完整读出
+    bool finish();
+
+    QString errorString() const;
+
+private:
+    enum class State {
+        Header,
+        Index,
+        EntryData,
+        Done,
+        Failed
+    };
+
+    bool collect(const char*& data, qint64& size, int needed);
+    bool parseHeader();
+    bool parseIndex();
+    // 开始下一个条目，大小为0的条目直接结束
+    bool nextEntry();
+    bool endEntry();
+    bool fail(const QString& message);
+
+    EntryBeginHandler onBegin;
+    EntryDataHandler onData;
+    EntryEndHandler onEnd;
+
+    State state = State::Header;
+    QByteArray field;
+    quint32 entryCount = 0;
+    quint32 indexSize = 0;
+    std::vector<Entry> entries;
+    size_t current = 0;
+    quint64 remaining = 0;
+    bool extracting = false;
+    QCryptographicHash hasher{ QCryptographicHash::Md5 };
+    QString error;
+};
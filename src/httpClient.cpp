@@ -1,60 +1,450 @@
 ﻿#include "httpClient.h"
+#include "rateLimiter.h"
 
 #include <QtCore/QEventLoop>
+#include <QtCore/QRandomGenerator>
+#include <QtCore/QThreadStorage>
+#include <QtCore/QTimer>
 
+#include <algorithm>
+#include <memory>
+
+
+Q_LOGGING_CATEGORY(lcHttp, "updater.http", QtInfoMsg)
+
+int HTTPClient::debug_body_preview = 512;
+int HTTPClient::default_connect_timeout_ms = 15000;
+int HTTPClient::default_idle_timeout_ms = 30000;
+int HTTPClient::default_max_retries = 2;
+
+// 重试等待的起点和上限
+static const int BACKOFF_BASE_MS = 250;
+static const int BACKOFF_MAX_MS = 8000;
 
 HTTPClient::HTTPClient(QObject* parent_object)
 	: QObject(parent_object)
 {
+	QObject::connect(&this->manager_, &QNetworkAccessManager::encrypted, this, [this](QNetworkReply*) {
+		++this->stats_.tls_handshakes;
+	});
+}
 
+HTTPClient& HTTPClient::getInstance() {
+	static QThreadStorage<HTTPClient*> instances;
+	if (!instances.hasLocalData()) {
+		instances.setLocalData(new HTTPClient());
+	}
+	return *instances.localData();
 }
 
-HTTPResponse HTTPClient::send(HTTPRequest& request) {
+void HTTPClient::preconnect(const QUrl& url) {
+	if (url.scheme() == "https") {
+		this->manager_.connectToHostEncrypted(url.host(), url.port(443));
+	}
+	else {
+		this->manager_.connectToHost(url.host(), url.port(80));
+	}
+	++this->stats_.preconnects;
+}
+
+HTTPPoolStats HTTPClient::stats() const {
+	return this->stats_;
+}
+
+int HTTPClient::backoff_ms(int attempt) {
+	// 退避时间 base * 2^(attempt-1)，封顶后在 [一半, 全部] 之间随机取值
+	int shift = qBound(0, attempt - 1, 16);
+	int ceiling = static_cast<int>(qMin<qint64>(BACKOFF_MAX_MS, qint64(BACKOFF_BASE_MS) << shift));
+	int half = ceiling / 2;
+	return half + static_cast<int>(QRandomGenerator::global()->bounded(quint32(ceiling - half + 1)));
+}
+
+// 失败是否值得重试：超时、连接层错误（没有拿到HTTP状态码）、服务器错误和限流
+static bool is_retryable(const HTTPResponse& response, bool timed_out) {
+	if (timed_out) {
+		return true;
+	}
+	if (response.status_code == 0) {
+		return response.error_code != QNetworkReply::NoError
+			&& response.error_code != QNetworkReply::OperationCanceledError;
+	}
+	return response.status_code >= 500 || response.status_code == 429;
+}
+
+bool HTTPClient::schedule_retry(HTTPTransfer* transfer, const HTTPResponse& response,
+	std::function<void(HTTPResponse&)> finish) {
+	bool idempotent = transfer->method_ == HTTPMethodType::HTTP_GET || transfer->method_ == HTTPMethodType::HTTP_HEAD;
+	if (!idempotent || transfer->aborted_ || transfer->attempt_ >= transfer->max_retries_
+		|| !is_retryable(response, transfer->timed_out_)) {
+		return false;
+	}
+
+	++transfer->attempt_;
+	int delay_ms = backoff_ms(transfer->attempt_);
+	qCInfo(lcHttp) << "请求失败，" << delay_ms << "毫秒后第" << transfer->attempt_ << "次重试："
+		<< transfer->url() << response.status_code << response.error_string;
+	++this->stats_.retries;
+
+	transfer->reply_ = nullptr;
+	transfer->give_up_ = [response, finish]() mutable {
+		response.error_code = QNetworkReply::OperationCanceledError;
+		response.error_string = "等待重试时被中止";
+		finish(response);
+	};
+	transfer->backoff_.start(delay_ms);
+	emit transfer->retrying(transfer->attempt_, delay_ms);
+	return true;
+}
+
+void HTTPClient::dispatch(HTTPTransfer* transfer) {
 	// 发送请求
+	const QNetworkRequest& request = transfer->request_;
 	QNetworkReply* q_reply = nullptr;
-	switch (request.http_method_type)
+	switch (transfer->method_)
 	{
 	case HTTPMethodType::HTTP_GET:
-		q_reply = this->manager_.get(request.create_QNetworkRequest());
+		q_reply = this->manager_.get(request);
 		break;
 	case HTTPMethodType::HTTP_POST:
-		q_reply = this->manager_.post(request.create_QNetworkRequest(), request.payload);
+		q_reply = this->manager_.post(request, transfer->payload_);
 		break;
 	case HTTPMethodType::HTTP_PUT:
-		q_reply = this->manager_.put(request.create_QNetworkRequest(), request.payload);
+		q_reply = this->manager_.put(request, transfer->payload_);
 		break;
 	case HTTPMethodType::HTTP_DELETE:
-		q_reply = this->manager_.deleteResource(request.create_QNetworkRequest());
+		q_reply = this->manager_.deleteResource(request);
+		break;
+	case HTTPMethodType::HTTP_HEAD:
+		q_reply = this->manager_.head(request);
 		break;
 	}
 
-	// 获取响应
-	HTTPResponse response;
-	if (q_reply != nullptr) {	// 这里判一下nullptr只是为了不让IDE报警告
-
-		// 同步阻塞，等待异步请求完成
-		QEventLoop loop;
-		QObject::connect(q_reply, &QNetworkReply::finished, &loop, &QEventLoop::quit);
-		loop.exec();
+	++this->stats_.requests_started;
+	this->stats_.peak_in_flight = qMax(this->stats_.peak_in_flight, ++this->stats_.in_flight);
+	QObject::connect(q_reply, &QNetworkReply::finished, this, [this, q_reply]() {
+		--this->stats_.in_flight;
+		++this->stats_.requests_finished;
+		if (q_reply->attribute(QNetworkRequest::Http2WasUsedAttribute).toBool()) {
+			++this->stats_.http2_responses;
+		}
+	});
 
-		// 响应信息提取
-		response = HTTPResponse(*q_reply);
-		q_reply->deleteLater();
-	}
+	transfer->attach(q_reply);
+	transfer->on_reply_(q_reply);
+}
 
-	// Http响应有效，但状态码不是2xx
-	if (!response.is_Status_2xx()) {
+// Http响应有效，但状态码不是2xx时打印提示
+static void debug_unexpected_status(const HTTPResponse& response) {
+	if (response.status_code < 200 || response.status_code >= 300) {
 
 		// 打印 状态码(http) 和 提示短语(http)
-		qDebug() << "服务器http响应异常：";
-		qDebug() << "状态码：" << response.status_code
+		qCWarning(lcHttp) << "服务器http响应异常：";
+		qCWarning(lcHttp) << "状态码：" << response.status_code
 			<< "提示短语：" << response.reason_phrase;
 	}
+}
+
+QString HTTPClient::format_body_preview(const QByteArray& body, int limit) {
+	if (body.isEmpty()) {
+		return "(empty)";
+	}
+	QByteArray head = body.left(limit);
+	QString size_note = QString(" (%1 bytes)").arg(body.size());
+
+	// 出现除制表、换行、回车以外的控制字符就当作二进制
+	bool binary = false;
+	for (char c : head) {
+		unsigned char u = static_cast<unsigned char>(c);
+		if (u < 0x20 && u != '\t' && u != '\n' && u != '\r') {
+			binary = true;
+			break;
+		}
+	}
+	if (binary) {
+		QString hex = QString::fromLatin1(head.left(limit / 2).toHex(' '));
+		return "<binary>" + size_note + " " + hex + (body.size() > limit / 2 ? " ..." : "");
+	}
+	if (body.size() > limit) {
+		return QString::fromUtf8(head) + " ..." + size_note;
+	}
+	return QString::fromUtf8(head);
+}
+
+HTTPTransfer* HTTPClient::sendAsync(HTTPRequest& request, HTTPFinishedHandler on_finished) {
+	HTTPTransfer* transfer = new HTTPTransfer(request, this);
+
+	auto finish = [transfer, on_finished](HTTPResponse& response) {
+		debug_unexpected_status(response);
+		on_finished(response);
+		transfer->deleteLater();
+	};
+	transfer->on_reply_ = [this, transfer, finish](QNetworkReply* q_reply) {
+		QObject::connect(q_reply, &QNetworkReply::finished, transfer, [this, q_reply, transfer, finish]() {
+			// 响应信息提取
+			HTTPResponse response(*q_reply);
+			transfer->finish_reply(response, response.payload.size());
+			q_reply->deleteLater();
+
+			if (!this->schedule_retry(transfer, response, finish)) {
+				finish(response);
+			}
+		});
+	};
+	this->dispatch(transfer);
+
+	return transfer;
+}
+
+HTTPTransfer* HTTPClient::downloadAsync(HTTPRequest& request, HTTPChunkHandler on_chunk, HTTPFinishedHandler on_finished,
+	HTTPHeadersHandler on_headers) {
+	HTTPTransfer* transfer = new HTTPTransfer(request, this);
+
+	// 下载状态随 transfer 存活，重试时沿用
+	struct StreamState {
+		HTTPChunkHandler on_chunk;
+		HTTPFinishedHandler on_finished;
+		HTTPHeadersHandler on_headers;
+		QByteArray buffer;
+		bool headers_checked = false;
+		bool chunk_failed = false;
+		qint64 bytes_received = 0;
+		QString url;
+	};
+	auto state = std::make_shared<StreamState>();
+	state->on_chunk = std::move(on_chunk);
+	state->on_finished = std::move(on_finished);
+	state->on_headers = std::move(on_headers);
+	state->buffer = QByteArray(STREAM_CHUNK_SIZE, Qt::Uninitialized);
+	state->url = request.get_final_url();
+
+	auto finish = [transfer, state](HTTPResponse& response) {
+		if (state->chunk_failed) {
+			response.error_string = "数据块处理失败，传输已中止";
+			qCWarning(lcHttp) << "流式下载中止：" << state->url;
+		}
+		else {
+			debug_unexpected_status(response);
+		}
+		state->on_finished(response);
+		transfer->deleteLater();
+	};
+
+	transfer->on_reply_ = [this, transfer, state, finish](QNetworkReply* q_reply) {
+		// 限制Qt内部的读缓冲区，数据来不及取走时由TCP流控限速，而不是无限堆在内存里
+		q_reply->setReadBufferSize(STREAM_CHUNK_SIZE * 4);
+
+		// 限速时令牌不够，等令牌攒够后再取数据
+		QTimer* throttle = new QTimer(q_reply);
+		throttle->setSingleShot(true);
+
+		// 把当前已到达的数据按块取走交给 on_chunk
+		// 限速时每块先向 RateLimiter 取令牌，取不到就留在 Qt 的读缓冲区里，等计时器到了再取；
+		// force 为true时（传输已结束）全部取走并记账
+		auto drain = [q_reply, state, throttle, transfer](bool force) {
+			int status_code = q_reply->attribute(QNetworkRequest::Attribute::HttpStatusCodeAttribute).toInt();
+			if (status_code < 200 || status_code >= 300) {
+				// 非2xx的响应体是错误页，不交给调用方
+				q_reply->readAll();
+				return;
+			}
+			if (!state->headers_checked) {
+				state->headers_checked = true;
+				if (state->on_headers && !state->on_headers(HTTPResponse(*q_reply, false))) {
+					state->chunk_failed = true;
+					q_reply->abort();
+					return;
+				}
+			}
+			RateLimiter& limiter = RateLimiter::getInstance();
+			while (!state->chunk_failed && q_reply->bytesAvailable() > 0) {
+				qint64 wanted = qMin<qint64>(state->buffer.size(), q_reply->bytesAvailable());
+				qint64 allowed = force ? wanted : limiter.acquire(wanted);
+				if (allowed <= 0) {
+					if (!throttle->isActive()) {
+						throttle->start(limiter.waitMs(wanted));
+					}
+					// 数据已经到了，是限速故意不取，缓冲区满后也不会再有进度，等令牌期间暂停空闲超时
+					transfer->set_throttled(true);
+					break;
+				}
+				qint64 read_size = q_reply->read(state->buffer.data(), allowed);
+				if (read_size <= 0) {
+					break;
+				}
+				// 取走数据后缓冲区有了空位，空闲超时从现在重新计时
+				transfer->set_throttled(false);
+				if (force) {
+					limiter.consume(read_size);
+				}
+				state->bytes_received += read_size;
+				if (!state->on_chunk(state->buffer.constData(), read_size)) {
+					state->chunk_failed = true;
+					q_reply->abort();
+				}
+			}
+		};
+
+		QObject::connect(q_reply, &QNetworkReply::readyRead, q_reply, [drain]() {
+			drain(false);
+		});
+		QObject::connect(throttle, &QTimer::timeout, q_reply, [drain]() {
+			drain(false);
+		});
+		QObject::connect(q_reply, &QNetworkReply::finished, transfer, [this, q_reply, transfer, state, drain, throttle, finish]() {
+			// finished 之前可能还有没取走的尾部数据
+			throttle->stop();
+			drain(true);
+
+			// 响应信息提取（响应体已经交给 on_chunk）
+			HTTPResponse response(*q_reply, false);
+			transfer->finish_reply(response, state->bytes_received);
+			q_reply->deleteLater();
+
+			// 响应头或数据已经交给调用方之后不能透明重试，由调用方决定（比如断点续传）
+			if (state->headers_checked || state->chunk_failed || !this->schedule_retry(transfer, response, finish)) {
+				finish(response);
+			}
+		});
+	};
+	this->dispatch(transfer);
+
+	return transfer;
+}
+
+HTTPResponse HTTPClient::send(HTTPRequest& request) {
+	HTTPResponse response;
+
+	// 同步阻塞，等待异步请求完成
+	QEventLoop loop;
+	this->sendAsync(request, [&](HTTPResponse& finished_response) {
+		response = finished_response;
+		loop.quit();
+	});
+	loop.exec();
+
+	return response;
+}
+
+HTTPResponse HTTPClient::download(HTTPRequest& request, const HTTPChunkHandler& on_chunk) {
+	HTTPResponse response;
+
+	// 同步阻塞，等待异步下载完成
+	QEventLoop loop;
+	this->downloadAsync(request, on_chunk, [&](HTTPResponse& finished_response) {
+		response = finished_response;
+		loop.quit();
+	});
+	loop.exec();
 
 	return response;
 }
 
 
+// HTTPTransfer 构造函数
+HTTPTransfer::HTTPTransfer(HTTPRequest& request, QObject* parent)
+	: QObject(parent)
+	, method_(request.http_method_type)
+	, request_(request.create_QNetworkRequest())
+	, payload_(request.payload)
+	, connect_timeout_ms_(request.connect_timeout_ms)
+	, idle_timeout_ms_(request.idle_timeout_ms)
+	, max_retries_(request.max_retries)
+{
+	this->timer_.start();
+
+	this->watchdog_.setSingleShot(true);
+	QObject::connect(&this->watchdog_, &QTimer::timeout, this, [this]() {
+		if (this->reply_) {
+			qCWarning(lcHttp) << "请求超时：" << this->url();
+			this->timed_out_ = true;
+			this->reply_->abort();
+		}
+	});
+
+	// 重试等待结束，重新发出请求
+	this->backoff_.setSingleShot(true);
+	QObject::connect(&this->backoff_, &QTimer::timeout, this, [this]() {
+		this->give_up_ = nullptr;
+		static_cast<HTTPClient*>(this->parent())->dispatch(this);
+	});
+}
+
+void HTTPTransfer::attach(QNetworkReply* reply) {
+	this->reply_ = reply;
+	this->timed_out_ = false;
+	this->throttled_ = false;
+	this->headers_ms_ = -1;
+	this->attempt_timer_.start();
+
+	QObject::connect(reply, &QNetworkReply::metaDataChanged, this, [this]() {
+		if (this->headers_ms_ < 0) {
+			this->headers_ms_ = this->attempt_timer_.elapsed();
+			// 首字节延迟是自适应限速判断链路是否排队的依据
+			RateLimiter::getInstance().reportLatency(this->headers_ms_);
+		}
+		this->restart_watchdog(this->idle_timeout_ms_);
+	});
+	QObject::connect(reply, &QNetworkReply::downloadProgress, this, [this](qint64 bytes_received, qint64 bytes_total) {
+		this->restart_watchdog(this->idle_timeout_ms_);
+		emit progress(bytes_received, bytes_total);
+	});
+#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
+	QObject::connect(reply, &QNetworkReply::errorOccurred, this, [this, reply](QNetworkReply::NetworkError error_code) {
+		emit failed(error_code, reply->errorString());
+	});
+#else
+	QObject::connect(reply, QOverload<QNetworkReply::NetworkError>::of(&QNetworkReply::error), this, [this, reply](QNetworkReply::NetworkError error_code) {
+		emit failed(error_code, reply->errorString());
+	});
+#endif
+
+	this->restart_watchdog(this->connect_timeout_ms_);
+}
+
+void HTTPTransfer::restart_watchdog(int timeout_ms) {
+	if (timeout_ms > 0 && !this->throttled_) {
+		this->watchdog_.start(timeout_ms);
+	}
+	else {
+		this->watchdog_.stop();
+	}
+}
+
+void HTTPTransfer::set_throttled(bool throttled) {
+	this->throttled_ = throttled;
+	this->restart_watchdog(this->idle_timeout_ms_);
+}
+
+void HTTPTransfer::abort() {
+	this->aborted_ = true;
+	if (this->backoff_.isActive()) {
+		// 等待重试期间没有 reply，直接以上一次的失败结束
+		this->backoff_.stop();
+		auto give_up = std::move(this->give_up_);
+		this->give_up_ = nullptr;
+		give_up();
+	}
+	else if (this->reply_) {
+		this->reply_->abort();
+	}
+}
+
+QString HTTPTransfer::url() const {
+	return this->request_.url().toString();
+}
+
+void HTTPTransfer::finish_reply(HTTPResponse& response, qint64 bytes_received) {
+	this->watchdog_.stop();
+	if (this->timed_out_) {
+		response.error_code = QNetworkReply::TimeoutError;
+		response.error_string = "请求超时";
+	}
+	response.headers_ms = this->headers_ms_;
+	response.elapsed_ms = this->timer_.elapsed();
+	response.bytes_received = bytes_received;
+	response.retries = this->attempt_;
+}
+
 // HTTPRequest 构造函数
 HTTPRequest::HTTPRequest(HTTPMethodType http_method, QString url, bool use_default_headers)
 {
@@ -72,6 +462,10 @@ HTTPRequest::HTTPRequest(HTTPMethodType http_method, QString url, bool use_defau
 	// 发送参数/内容初始化置空
 	this->url_args = QHash<QString, QString>();
 	this->payload = QByteArray();
+
+	this->connect_timeout_ms = HTTPClient::default_connect_timeout_ms;
+	this->idle_timeout_ms = HTTPClient::default_idle_timeout_ms;
+	this->max_retries = HTTPClient::default_max_retries;
 }
 
 // HTTPResponse 构造函数
@@ -81,7 +475,7 @@ HTTPResponse::HTTPResponse()
 	this->use_default();
 }
 
-HTTPResponse::HTTPResponse(QNetworkReply& reply)
+HTTPResponse::HTTPResponse(QNetworkReply& reply, bool read_payload)
 {
 	// 所有值初始化为默认
 	this->use_default();
@@ -96,6 +490,9 @@ HTTPResponse::HTTPResponse(QNetworkReply& reply)
 	for (QNetworkReply::RawHeaderPair header_pair : reply.rawHeaderPairs()) {
 		this->headers[QString(header_pair.first)] = QString(header_pair.second);
 	};
-	this->payload = reply.readAll();
+	this->content_encoding = QString(reply.rawHeader("Content-Encoding"));
+	if (read_payload) {
+		this->payload = reply.readAll();
+	}
 }
 
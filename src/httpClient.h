@@ -2,35 +2,182 @@
 
 #include <QtCore/QObject>
 #include <QtNetwork/QNetworkReply>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QPointer>
+#include <QtCore/QTimer>
 #include <QJsonObject>
 #include <QJsonArray>
 #include <QJsonDocument>
 
+#include <functional>
+
+
+// HTTP 请求/响应详情的日志分类，调试级别默认关闭
+// 打开方式：updater.ini 中 [log] http=true，或环境变量 QT_LOGGING_RULES="updater.http.debug=true"
+// 关闭时 SimpleDebug 直接返回，不会格式化任何内容
+Q_DECLARE_LOGGING_CATEGORY(lcHttp)
 
 // 有脏东西定义了名为DELETE的宏，为保持格式统一才加了HTTP_前缀
 enum HTTPMethodType {
 	HTTP_GET,
 	HTTP_POST,
 	HTTP_PUT,
-	HTTP_DELETE
+	HTTP_DELETE,
+	HTTP_HEAD
 };
 class HTTPRequest;
 class HTTPResponse;
 
+// 连接池统计，每个线程的 HTTPClient 各自统计
+// Qt 不报告连接是否复用，这里记录的是能观察到的部分
+struct HTTPPoolStats {
+	qint64 requests_started = 0;
+	qint64 requests_finished = 0;
+	qint64 in_flight = 0;
+	qint64 peak_in_flight = 0;
+	qint64 http2_responses = 0;		// 实际走了HTTP/2的响应数
+	qint64 tls_handshakes = 0;		// 新建的TLS连接数，复用的连接不会再握手
+	qint64 preconnects = 0;
+	qint64 retries = 0;				// 超时或失败后自动重发的次数
+};
+
+// 流式下载的数据块回调：每读到一块响应体数据调用一次
+// 返回false表示调用方处理失败（比如写盘出错），传输会被中止
+using HTTPChunkHandler = std::function<bool(const char* data, qint64 size)>;
+// 流式下载收到响应头时的回调，在第一块数据之前调用一次（只针对2xx响应）
+// 此时 HTTPResponse 只有状态码和响应头，返回false表示不接受该响应，传输会被中止
+using HTTPHeadersHandler = std::function<bool(const HTTPResponse& head)>;
+// 异步请求完成时的回调
+using HTTPFinishedHandler = std::function<void(HTTPResponse& response)>;
+
+// 一个进行中的异步请求，由 sendAsync/downloadAsync 返回
+// 对象归 HTTPClient 管理，on_finished 回调结束后自动释放，调用方不要 delete，也不要在回调之后继续使用
+// 失败重试时会发出新的 QNetworkReply，但对调用方始终是同一个 HTTPTransfer
+class HTTPTransfer : public QObject
+{
+	Q_OBJECT
+public:
+	// 中止请求，on_finished 仍会被调用（error_code 为 OperationCanceledError）
+	// 正在等待重试时不再重试，直接结束
+	void abort();
+
+	QString url() const;
+
+signals:
+	// 下载进度，bytes_total 未知时为-1；重试时从0重新开始
+	void progress(qint64 bytes_received, qint64 bytes_total);
+	// Qt层报告错误（网络错误或非2xx状态码），随后会重试或收到 on_finished
+	void failed(QNetworkReply::NetworkError error_code, const QString& error_string);
+	// 请求失败，delay_ms 毫秒后进行第 attempt 次重试
+	void retrying(int attempt, int delay_ms);
+
+private:
+	friend class HTTPClient;
+	HTTPTransfer(HTTPRequest& request, QObject* parent);
+
+	// 为新发出的 reply 连接信号，并开始超时检测
+	void attach(QNetworkReply* reply);
+	// reply 结束：停止超时检测，把耗时统计填进响应，超时导致的中止改报 TimeoutError
+	void finish_reply(HTTPResponse& response, qint64 bytes_received);
+	// 重新开始超时计时，timeout_ms 为0时停止；限速等待期间不计时
+	void restart_watchdog(int timeout_ms);
+	// 限速时数据留在读缓冲区里不取，不会有进度，这段时间不算空闲；取走数据时恢复计时
+	void set_throttled(bool throttled);
+
+	// 重发请求需要的全部信息
+	HTTPMethodType method_;
+	QNetworkRequest request_;
+	QByteArray payload_;
+	int connect_timeout_ms_;
+	int idle_timeout_ms_;
+	int max_retries_;
+
+	// 当前的 reply，等待重试期间为空
+	QPointer<QNetworkReply> reply_;
+	// 每发出一个 reply 调用一次，连接结果的处理（普通请求和流式下载不同）
+	std::function<void(QNetworkReply*)> on_reply_;
+	// 等待重试期间被 abort 时调用，以上一次的失败结束请求
+	std::function<void()> give_up_;
+
+	// 连接超时（等响应头）和空闲超时（等下一块数据）共用一个计时器
+	QTimer watchdog_;
+	QTimer backoff_;
+	bool timed_out_ = false;
+	bool throttled_ = false;
+	bool aborted_ = false;
+	int attempt_ = 0;
+
+	// 从第一次发出请求开始计时，包括重试
+	QElapsedTimer timer_;
+	// 本次尝试的计时，首字节延迟按本次尝试算
+	QElapsedTimer attempt_timer_;
+	qint64 headers_ms_ = -1;
+};
+
+// 每个线程一个实例（QNetworkAccessManager 不能跨线程使用），线程结束时自动释放
+// 同一线程内的请求共用一个 QNetworkAccessManager，从而共用它的连接池：
+// 对同一主机的 HTTP/1.1 连接会保持并复用（每个主机最多6个并行连接），HTTPS 下服务器支持时走 HTTP/2 多路复用
 class HTTPClient : public QObject
 {
 	Q_OBJECT
 public:
-	static HTTPClient& getInstance() {
-		static HTTPClient instance;
-		return instance;
-	}
-	
+	// 当前线程的实例
+	static HTTPClient& getInstance();
+
+	// 由 QThreadStorage 在线程结束时释放
+	~HTTPClient() = default;
+
+	// 预先建立到 url 所在主机的连接（HTTPS 会完成握手），之后的请求直接复用
+	void preconnect(const QUrl& url);
+
+	// 当前线程的连接池统计
+	HTTPPoolStats stats() const;
+
+	// 异步发送请求，立即返回，不阻塞，多个请求可以同时进行
+	// 完成后在当前线程的事件循环中回调 on_finished，响应体完整地放在 HTTPResponse::payload 中
+	HTTPTransfer* sendAsync(HTTPRequest& request, HTTPFinishedHandler on_finished);
+
+	// 流式下载的异步版本，用于大文件
+	// 响应体不会进入 HTTPResponse::payload，而是边收边按块交给 on_chunk，
+	// 内存占用只与块大小有关，与文件大小无关
+	// 只有2xx响应的响应体才会交给 on_chunk
+	// on_headers 可选，用于在写入数据前检查响应（比如续传时确认服务器返回的是206）
+	HTTPTransfer* downloadAsync(HTTPRequest& request, HTTPChunkHandler on_chunk, HTTPFinishedHandler on_finished,
+		HTTPHeadersHandler on_headers = nullptr);
+
+	// 同步阻塞版本，内部用局部事件循环等待异步版本完成
+	// 只适合在没有自己事件循环的场合使用，Updater 里应使用异步版本
 	HTTPResponse send(HTTPRequest& request);
+	HTTPResponse download(HTTPRequest& request, const HTTPChunkHandler& on_chunk);
+
+	// 流式下载每次读取的块大小
+	static constexpr qint64 STREAM_CHUNK_SIZE = 64 * 1024;
+
+	// 新建 HTTPRequest 的默认超时（毫秒，0 表示不限制）和重试次数，见 HTTPRequest 的同名字段
+	static int default_connect_timeout_ms;
+	static int default_idle_timeout_ms;
+	static int default_max_retries;
+
+	// 第 attempt 次重试前的等待：指数退避，上限 8 秒，再在后一半区间内随机抖动，
+	// 避免大量客户端在服务器恢复的同一时刻一起重试
+	static int backoff_ms(int attempt);
+
+	// 调试输出中请求/响应体最多显示的字节数
+	static int debug_body_preview;
+	// 把请求/响应体格式化成调试用的预览：文本截断到 limit 字节，二进制显示为hex，都附带总大小
+	static QString format_body_preview(const QByteArray& body, int limit);
 
 private:
+	friend class HTTPTransfer;
 	HTTPClient(QObject* parent_object = nullptr);
-	~HTTPClient() = default;
+
+	// 按请求方法发出（或重发）transfer 对应的请求
+	void dispatch(HTTPTransfer* transfer);
+	// reply 失败后判断是否重试：需要时安排重试并返回true，否则返回false由调用方结束请求
+	// finish 在等待重试期间被 abort 时用来结束请求
+	bool schedule_retry(HTTPTransfer* transfer, const HTTPResponse& response,
+		std::function<void(HTTPResponse&)> finish);
 
 public:
 	// 静态工具函数，参数拼接成url格式的字符串
@@ -52,6 +199,7 @@ public:
 
 private:
 	QNetworkAccessManager manager_;
+	HTTPPoolStats stats_;
 };
 
 
@@ -69,20 +217,48 @@ public:
 	QHash<QString, QString> url_args;
 	QByteArray payload;
 
+	// 是否接受压缩传输（gzip/deflate）
+	// 为true时不设置 Accept-Encoding，交给 QNetworkAccessManager 自动声明并在接收时流式解压，
+	// 调用方（包括流式下载的 on_chunk 和哈希校验）拿到的始终是解压后的原始字节
+	// 注意：手动设置 Accept-Encoding 头会关闭Qt的自动解压
+	// 服务器可以把预先压缩好的 <文件>.gz 放在原文件旁边，带 Content-Encoding: gzip 返回（nginx gzip_static 的做法）
+	bool accept_compressed = true;
+
+	// HTTPS 请求是否允许协商 HTTP/2（ALPN），服务器不支持时自动使用 HTTP/1.1
+	// 明文 HTTP 不启用：h2c 需要协议升级，部分代理和服务器处理不好
+	bool allow_http2 = true;
+
+	// 超时（毫秒），0 表示不限制，默认值来自 HTTPClient::default_*
+	// 连接超时：从发出请求到收到响应头；空闲超时：收到响应头之后连续多久没有新数据
+	// 用计时器实现而不是 setTransferTimeout，后者要 Qt 5.15，而且不区分这两种情况
+	int connect_timeout_ms;
+	int idle_timeout_ms;
+	// 超时、网络错误、5xx 和 429 时的最大重试次数，只对 GET/HEAD 生效
+	// 流式下载只在还没有把响应交给调用方（on_headers/on_chunk）之前重试
+	int max_retries;
+
 	QNetworkRequest create_QNetworkRequest() {
 		QNetworkRequest request;
 		// headers 设置
 		for (auto it = this->headers.begin(); it != this->headers.end(); ++it) {
 			request.setRawHeader(it.key().toUtf8(), it.value().toUtf8());
 		}
+		if (!this->accept_compressed) {
+			request.setRawHeader("Accept-Encoding", "identity");
+		}
 
 		// 最终 url (包含url参数拼接)
 		request.setUrl(this->get_final_url());
 
+		if (this->allow_http2 && request.url().scheme() == "https") {
+			request.setAttribute(QNetworkRequest::Http2AllowedAttribute, true);
+		}
+
 		return request;
 	}
 
 	// 默认使用的header配置
+	// 不要在这里加 Accept-Encoding，见 accept_compressed
 	QHash<QString, QString> get_default_headers() {
 		QHash<QString, QString> default_headers = QHash<QString, QString>();
 		default_headers["Content-Type"] = "application/json";
@@ -139,32 +315,38 @@ public:
 
 	// 一些便捷函数，供外部打印Debug
 	void SimpleDebug() {
-		qDebug() << "";
-		qDebug() << "=====Request=====";
+		if (!lcHttp().isDebugEnabled()) {
+			return;
+		}
+		qCDebug(lcHttp) << "";
+		qCDebug(lcHttp) << "=====Request=====";
 		switch (this->http_method_type)
 		{
 		case HTTPMethodType::HTTP_GET:
-			qDebug() << "Http Method: GET";
+			qCDebug(lcHttp) << "Http Method: GET";
 			break;
 		case HTTPMethodType::HTTP_POST:
-			qDebug() << "Http Method: POST";
+			qCDebug(lcHttp) << "Http Method: POST";
 			break;
 		case HTTPMethodType::HTTP_PUT:
-			qDebug() << "Http Method: PUT";
+			qCDebug(lcHttp) << "Http Method: PUT";
 			break;
 		case HTTPMethodType::HTTP_DELETE:
-			qDebug() << "Http Method: DELETE";
+			qCDebug(lcHttp) << "Http Method: DELETE";
+			break;
+		case HTTPMethodType::HTTP_HEAD:
+			qCDebug(lcHttp) << "Http Method: HEAD";
 			break;
 		}
-		qDebug() << "url:";
-		qDebug() << " " << this->get_final_url();
-		qDebug() << "headers:";
+		qCDebug(lcHttp) << "url:";
+		qCDebug(lcHttp) << " " << this->get_final_url();
+		qCDebug(lcHttp) << "headers:";
 		for (auto it = this->headers.begin(); it != this->headers.end(); it++) {
-			qDebug() << " " << it.key() << ": " << it.value();
+			qCDebug(lcHttp) << " " << it.key() << ": " << it.value();
 		}
-		qDebug() << "payload:";
-		qDebug() << " " << QString(this->payload);
-		qDebug() << "=====Request=====";
+		qCDebug(lcHttp) << "payload:";
+		qCDebug(lcHttp) << " " << HTTPClient::format_body_preview(this->payload, HTTPClient::debug_body_preview);
+		qCDebug(lcHttp) << "=====Request=====";
 	}
 	QString get_final_url() {
 		QString url_args_string = this->get_url_args_string();
@@ -189,7 +371,8 @@ class HTTPResponse {
 
 public:
 	HTTPResponse();
-	HTTPResponse(QNetworkReply& reply);
+	// read_payload 为false时不读取响应体（流式下载时响应体已经被分块取走）
+	HTTPResponse(QNetworkReply& reply, bool read_payload = true);
 	~HTTPResponse() = default;
 
 	// 未成功收到响应时的错误信息
@@ -202,6 +385,17 @@ public:
 	QHash<QString, QString> headers;
 	QByteArray payload;
 
+	// 响应体在传输时使用的压缩编码（比如 gzip），未压缩时为空
+	// payload 和流式下载拿到的数据都已经解压，这里只用于记录和调试
+	QString content_encoding;
+
+	// 耗时统计（毫秒，从发出请求开始计），由 HTTPClient 填写
+	// Qt 不单独报告DNS解析和建立连接的耗时，它们都算在 headers_ms 里
+	qint64 headers_ms;		// 收到响应头，没收到时为-1
+	qint64 elapsed_ms;		// 请求结束
+	qint64 bytes_received;	// 响应体字节数（解压后）
+	int retries;			// 自动重试的次数；重试时 elapsed_ms 包括之前的尝试和等待，headers_ms 只算最后一次
+
 public:
 	void use_default() {
 		this->error_code = QNetworkReply::NetworkError::UnknownNetworkError;
@@ -210,6 +404,11 @@ public:
 		this->reason_phrase = QString();
 		this->headers = QHash<QString, QString>();
 		this->payload = QByteArray();
+		this->content_encoding = QString();
+		this->headers_ms = -1;
+		this->elapsed_ms = 0;
+		this->bytes_received = 0;
+		this->retries = 0;
 	}
 
 	// 重要！
@@ -256,21 +455,40 @@ public:
 		return json_array;
 	};
 
+	// 按名称取响应头，名称不区分大小写，不存在时返回空字符串
+	QString get_header(const QString& key) const {
+		for (auto it = this->headers.begin(); it != this->headers.end(); it++) {
+			if (it.key().compare(key, Qt::CaseInsensitive) == 0) {
+				return it.value();
+			}
+		}
+		return QString();
+	}
+
 	// 一些便捷函数，供外部打印Debug
 	void SimpleDebug() {
-		qDebug() << "";
-		qDebug() << "=====Response=====";
+		if (!lcHttp().isDebugEnabled()) {
+			return;
+		}
+		qCDebug(lcHttp) << "";
+		qCDebug(lcHttp) << "=====Response=====";
 		if (this->error_code != QNetworkReply::NetworkError::NoError) {
-			qDebug() << "error code: " << (int)this->error_code << "   " << "error string: " << this->error_string;
+			qCDebug(lcHttp) << "error code: " << (int)this->error_code << "   " << "error string: " << this->error_string;
+		}
+		qCDebug(lcHttp) << "status code: " << this->status_code << "   " << "reason phrase: " << this->reason_phrase;
+		qCDebug(lcHttp) << "elapsed(ms): " << this->elapsed_ms << "   " << "headers(ms): " << this->headers_ms
+			<< "   " << "bytes: " << this->bytes_received;
+		if (!this->content_encoding.isEmpty()) {
+			qCDebug(lcHttp) << "content encoding: " << this->content_encoding << " (decoded)";
 		}
-		qDebug() << "status code: " << this->status_code << "   " << "reason phrase: " << this->reason_phrase;
-		qDebug() << "headers:";
+		qCDebug(lcHttp) << "headers:";
 		for (auto it = this->headers.begin(); it != this->headers.end(); it++) {
-			qDebug() << " " << it.key() << ": " << it.value();
+			qCDebug(lcHttp) << " " << it.key() << ": " << it.value();
 		}
-		qDebug() << "payload:";
-		qDebug() << " " << this->get_payload_QString();
-		qDebug() << "=====Response=====";
+		// 流式下载的响应体不在 payload 里，这里只会显示空
+		qCDebug(lcHttp) << "payload:";
+		qCDebug(lcHttp) << " " << HTTPClient::format_body_preview(this->payload, HTTPClient::debug_body_preview);
+		qCDebug(lcHttp) << "=====Response=====";
 	}
 	QString get_headers_string_format() {
 		QString str = "";
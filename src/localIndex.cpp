@@ -0,0 +1,154 @@
+﻿#include "localIndex.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QCryptographicHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <QDebug>
+
+
+// 不小于这个大小的文件用内存映射读取，省掉读入缓冲区的拷贝
+static const qint64 MAP_THRESHOLD = 4 * 1024 * 1024;
+// 映射后分段交给哈希计算，QCryptographicHash::addData 的长度是 int
+static const qint64 MAP_HASH_CHUNK = 64 * 1024 * 1024;
+
+LocalFileIndex::LocalFileIndex(const QString& indexPath)
+    : indexPath(indexPath)
+{
+}
+
+bool LocalFileIndex::load() {
+    entries.clear();
+    dirty = false;
+
+    QFile file(indexPath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        // 第一次运行没有索引文件，属于正常情况
+        return false;
+    }
+
+    QJsonObject files = QJsonDocument::fromJson(file.readAll()).object()["files"].toObject();
+    for (auto it = files.begin(); it != files.end(); ++it) {
+        QJsonObject obj = it.value().toObject();
+        Entry entry;
+        entry.size = static_cast<qint64>(obj["size"].toDouble(-1));
+        entry.mtime = static_cast<qint64>(obj["mtime"].toDouble(-1));
+        entry.hash = obj["hash"].toString();
+        entries.insert(it.key(), entry);
+    }
+    qDebug() << "Local index loaded, entries: " << entries.size();
+    return true;
+}
+
+bool LocalFileIndex::save() {
+    if (!dirty) {
+        return true;
+    }
+
+    QJsonObject files;
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        QJsonObject obj;
+        obj["size"] = static_cast<double>(it.value().size);
+        obj["mtime"] = static_cast<double>(it.value().mtime);
+        obj["hash"] = it.value().hash;
+        files[it.key()] = obj;
+    }
+    QJsonObject root;
+    root["files"] = files;
+
+    // 先写临时文件再替换，避免写到一半断电导致索引损坏
+    QString tempPath = indexPath + ".tmp";
+    QFile file(tempPath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qDebug() << "Failed to write local index: " << tempPath;
+        return false;
+    }
+    file.write(QJsonDocument(root).toJson(QJsonDocument::Compact));
+    file.close();
+
+    QFile::remove(indexPath);
+    if (!QFile::rename(tempPath, indexPath)) {
+        qDebug() << "Failed to replace local index: " << indexPath;
+        return false;
+    }
+    dirty = false;
+    return true;
+}
+
+QString LocalFileIndex::hashOf(const QString& path) {
+    QFileInfo info(path);
+    if (!info.exists()) {
+        if (entries.remove(path) > 0) {
+            dirty = true;
+        }
+        return QString();
+    }
+
+    qint64 size = info.size();
+    qint64 mtime = info.lastModified().toMSecsSinceEpoch();
+
+    auto it = entries.find(path);
+    if (it != entries.end() && it.value().size == size && it.value().mtime == mtime) {
+        return it.value().hash;
+    }
+
+    // 大小或修改时间变了，重新计算
+    Entry entry;
+    entry.size = size;
+    entry.mtime = mtime;
+    entry.hash = computeHash(path);
+    entries.insert(path, entry);
+    dirty = true;
+    return entry.hash;
+}
+
+bool LocalFileIndex::matches(const QString& path, const std::string& expectedHash) {
+    QString hash = hashOf(path);
+    return !hash.isEmpty() && hash == QString::fromStdString(expectedHash);
+}
+
+void LocalFileIndex::update(const QString& path, const QString& hash) {
+    QFileInfo info(path);
+    if (!info.exists()) {
+        remove(path);
+        return;
+    }
+    Entry entry;
+    entry.size = info.size();
+    entry.mtime = info.lastModified().toMSecsSinceEpoch();
+    entry.hash = hash;
+    entries.insert(path, entry);
+    dirty = true;
+}
+
+void LocalFileIndex::remove(const QString& path) {
+    if (entries.remove(path) > 0) {
+        dirty = true;
+    }
+}
+
+QString LocalFileIndex::computeHash(const QString& path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QString();
+    }
+    QCryptographicHash hasher(QCryptographicHash::Md5);
+    qint64 size = file.size();
+    uchar* mapped = size >= MAP_THRESHOLD ? file.map(0, size) : nullptr;
+    if (mapped) {
+        for (qint64 offset = 0; offset < size; offset += MAP_HASH_CHUNK) {
+            qint64 length = qMin(MAP_HASH_CHUNK, size - offset);
+            hasher.addData(reinterpret_cast<const char*>(mapped + offset), static_cast<int>(length));
+        }
+        file.unmap(mapped);
+        return hasher.result().toHex();
+    }
+    // 小文件或者映射失败（比如32位进程地址空间不够）时按普通方式读取
+    if (!hasher.addData(&file)) {
+        return QString();
+    }
+    return hasher.result().toHex();
+}
@@ -0,0 +1,47 @@
+﻿#pragma once
+
+#include <string>
+
+#include <QString>
+#include <QHash>
+
+
+// ======================
+// 本地文件哈希索引
+// ======================
+// 持久化记录本地文件的 (路径, 大小, 修改时间, 哈希)
+// 文件大小和修改时间都没变时直接复用记录的哈希，只有变了才重新计算，
+// 这样每次更新前检查"本地文件是否已经是目标版本"几乎没有开销
+class LocalFileIndex {
+public:
+    explicit LocalFileIndex(const QString& indexPath);
+
+    // 从磁盘读取/写回索引文件
+    bool load();
+    bool save();
+
+    // 获取本地文件当前的哈希（小写hex），文件不存在时返回空字符串
+    QString hashOf(const QString& path);
+
+    // 本地文件是否存在且哈希与期望值一致
+    bool matches(const QString& path, const std::string& expectedHash);
+
+    // 文件刚写入且哈希已校验过时调用，直接记录，不再重新计算
+    void update(const QString& path, const QString& hash);
+    void remove(const QString& path);
+
+    // 计算文件的哈希（小写hex），不读也不写索引，可以在多个线程中同时调用
+    // 大文件通过内存映射读取，失败时返回空字符串
+    static QString computeHash(const QString& path);
+
+private:
+    struct Entry {
+        qint64 size = -1;
+        qint64 mtime = -1;
+        QString hash;
+    };
+
+    QString indexPath;
+    QHash<QString, Entry> entries;
+    bool dirty = false;
+};
@@ -1,32 +1,90 @@
 ﻿#include "updaterUI.h"
+#include "headlessRunner.h"
+#include "asyncLogger.h"
+
+#include <cstring>
 
 #include <QtWidgets/QApplication>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <cstdio>
+#endif
 
 
-#include <QMutex>
-#include <QMutexLocker>
-#include <QFile>
-#include <QTextStream>
-#include <QDebug>
-void myMessageHandle(QtMsgType, const QMessageLogContext&, const QString& msg)
+// 命令行中有无界面参数时不创建 QApplication，也不加载任何界面资源
+static bool hasHeadlessOption(int argc, char* argv[])
 {
-    static QMutex mut; //多线程打印时需要加锁
-    QMutexLocker locker(&mut);
-    QFile file("updater.log");
-    if (file.open(QIODevice::WriteOnly | QIODevice::Append))
-    {
-        QTextStream stream(&file);
-        stream << msg << Qt::endl;
-        file.close();
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--headless") == 0
+            || std::strcmp(argv[i], "--check-only") == 0
+            || std::strcmp(argv[i], "--apply") == 0
+            || std::strcmp(argv[i], "--verify") == 0) {
+            return true;
+        }
     }
+    return false;
 }
 
-int main(int argc, char *argv[])
+static int runHeadless(int argc, char* argv[])
 {
-    qInstallMessageHandler(myMessageHandle);
-    QApplication app(argc, argv);
-    app.setFont(QFont("微软雅黑", 12));
-    UpdaterUI window;
-    window.show();
+#ifdef Q_OS_WIN
+    // 程序是 Windows 子系统，从控制台直接运行时没有标准输出，挂到父进程的控制台上
+    // 被脚本重定向输出时句柄已经有效，不需要处理
+    if (GetStdHandle(STD_OUTPUT_HANDLE) == nullptr && AttachConsole(ATTACH_PARENT_PROCESS)) {
+        FILE* stream = nullptr;
+        freopen_s(&stream, "CONOUT$", "w", stdout);
+        freopen_s(&stream, "CONOUT$", "w", stderr);
+    }
+#endif
+
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Updater, headless mode. Exit codes: 0 up to date or updated, "
+        "1 failed, 2 update available or files corrupted (--check-only), 3 installer ready (--apply), 4 launch failed.");
+    parser.addHelpOption();
+    QCommandLineOption headlessOption("headless", "Check, update and launch the program without a window.");
+    QCommandLineOption checkOnlyOption("check-only", "Only check whether an update is available.");
+    QCommandLineOption applyOption("apply", "Check and apply updates, but do not launch anything.");
+    QCommandLineOption verifyOption("verify", "Re-hash all installed files and repair missing or corrupted ones. "
+        "Does not launch anything unless combined with --headless; with --check-only only reports.");
+    parser.addOptions({ headlessOption, checkOnlyOption, applyOption, verifyOption });
+    parser.process(app);
+
+    HeadlessRunner::Mode mode = HeadlessRunner::Mode::Run;
+    if (parser.isSet(checkOnlyOption)) {
+        mode = HeadlessRunner::Mode::CheckOnly;
+    }
+    else if (parser.isSet(applyOption) || (parser.isSet(verifyOption) && !parser.isSet(headlessOption))) {
+        mode = HeadlessRunner::Mode::Apply;
+    }
+
+    HeadlessRunner runner(mode, parser.isSet(verifyOption));
+    runner.start();
     return app.exec();
 }
+
+
+int main(int argc, char *argv[])
+{
+    // 日志由后台线程批量写入，qDebug 本身不做文件IO
+    AsyncLogger::getInstance().start("updater.log");
+    qInstallMessageHandler(AsyncLogger::messageHandler);
+    int result = 0;
+    if (hasHeadlessOption(argc, argv)) {
+        result = runHeadless(argc, argv);
+    }
+    else {
+        QApplication app(argc, argv);
+        app.setFont(QFont("微软雅黑", 12));
+        UpdaterUI window;
+        window.show();
+        result = app.exec();
+    }
+    // 窗口和工作线程析构时也会打日志，全部结束后再写完剩余日志
+    AsyncLogger::getInstance().stop();
+    return result;
+}
@@ -0,0 +1,482 @@
+﻿#include "manifestTable.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#include <QCborStreamReader>
+#include <QCborStreamWriter>
+#include <QJsonArray>
+
+
+static int hexValue(unsigned c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// 读出当前的文本或字节串，按块直接拷进 out，不经过 QString，out 的容量在多次调用间复用
+static bool readString(QCborStreamReader& reader, std::string& out) {
+    out.clear();
+    QCborStreamReader::StringResult<qsizetype> result;
+    do {
+        qsizetype chunk = qMax<qsizetype>(0, reader.currentStringChunkSize());
+        size_t old = out.size();
+        out.resize(old + chunk);
+        result = reader.readStringChunk(&out[0] + old, chunk);
+        out.resize(old + (result.status == QCborStreamReader::Ok ? result.data : 0));
+    } while (result.status == QCborStreamReader::Ok);
+    return result.status == QCborStreamReader::EndOfString;
+}
+
+// 哈希可以是16字节的字节串，也可以是hex文本
+static bool readDigest(QCborStreamReader& reader, std::string& scratch, ManifestTable::Digest& digest) {
+    if (reader.isByteArray()) {
+        if (!readString(reader, scratch) || scratch.size() != ManifestTable::DIGEST_SIZE) {
+            return false;
+        }
+        std::memcpy(digest.data(), scratch.data(), ManifestTable::DIGEST_SIZE);
+        return true;
+    }
+    return reader.isString() && readString(reader, scratch) && ManifestTable::parseHex(scratch, digest);
+}
+
+void ManifestTable::clear() {
+    version.clear();
+    hash.clear();
+    hotfix = -1;
+    mainProgram.clear();
+    bundle.clear();
+
+    dirs.assign(1, std::string());
+    dirIndex.clear();
+    names.clear();
+    nameEnd.clear();
+    dirOf.clear();
+    digests.clear();
+    patchBegin.assign(1, 0);
+    patchDigests.clear();
+}
+
+int ManifestTable::size() const {
+    return static_cast<int>(digests.size());
+}
+
+std::string ManifestTable::path(int i) const {
+    unsigned begin = i > 0 ? nameEnd[i - 1] : 0;
+    std::string result = dirs[dirOf[i]];
+    result.append(names, begin, nameEnd[i] - begin);
+    return result;
+}
+
+QString ManifestTable::filePath(int i) const {
+    return QString::fromStdString(path(i));
+}
+
+const ManifestTable::Digest& ManifestTable::digest(int i) const {
+    return digests[i];
+}
+
+std::string ManifestTable::hexDigest(int i) const {
+    return toHex(digests[i]);
+}
+
+bool ManifestTable::digestMatches(int i, const QString& hex) const {
+    if (hex.size() != DIGEST_SIZE * 2) {
+        return false;
+    }
+    const Digest& expected = digests[i];
+    for (int k = 0; k < DIGEST_SIZE; ++k) {
+        int high = hexValue(hex[2 * k].unicode());
+        int low = hexValue(hex[2 * k + 1].unicode());
+        if (high < 0 || low < 0 || expected[k] != ((high << 4) | low)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int ManifestTable::patchCount(int i) const {
+    return static_cast<int>(patchBegin[i + 1] - patchBegin[i]);
+}
+
+const ManifestTable::Digest& ManifestTable::patchDigest(int i, int k) const {
+    return patchDigests[patchBegin[i] + k];
+}
+
+int ManifestTable::distinctDigests() const {
+    std::vector<Digest> sorted(digests);
+    std::sort(sorted.begin(), sorted.end());
+    return static_cast<int>(std::unique(sorted.begin(), sorted.end()) - sorted.begin());
+}
+
+FileInfo ManifestTable::fileInfo(int i) const {
+    FileInfo info;
+    info.filename = path(i);
+    info.hash = hexDigest(i);
+    info.patchFrom.reserve(patchCount(i));
+    for (int k = 0; k < patchCount(i); ++k) {
+        info.patchFrom.push_back(toHex(patchDigest(i, k)));
+    }
+    return info;
+}
+
+size_t ManifestTable::memoryBytes() const {
+    size_t bytes = dirs.capacity() * sizeof(std::string);
+    for (const std::string& dir : dirs) {
+        bytes += heapBytes(dir);
+    }
+    bytes += names.capacity() + 1;
+    bytes += (nameEnd.capacity() + dirOf.capacity() + patchBegin.capacity()) * sizeof(unsigned);
+    bytes += (digests.capacity() + patchDigests.capacity()) * sizeof(Digest);
+    return bytes;
+}
+
+size_t ManifestTable::heapBytes(const std::string& text) {
+    const char* data = text.data();
+    const char* object = reinterpret_cast<const char*>(&text);
+    bool embedded = data >= object && data < object + sizeof(std::string);
+    return embedded ? 0 : text.capacity() + 1;
+}
+
+int ManifestTable::append(std::string_view path, const Digest& digest) {
+    size_t slash = path.rfind('/');
+    unsigned dir = 0;
+    if (slash != std::string_view::npos) {
+        dirKey.assign(path.data(), slash + 1);
+        auto it = dirIndex.find(dirKey);
+        if (it == dirIndex.end()) {
+            dir = static_cast<unsigned>(dirs.size());
+            dirs.push_back(dirKey);
+            dirIndex.emplace(dirKey, dir);
+        }
+        else {
+            dir = it->second;
+        }
+        path.remove_prefix(slash + 1);
+    }
+    names.append(path.data(), path.size());
+    nameEnd.push_back(static_cast<unsigned>(names.size()));
+    dirOf.push_back(dir);
+    digests.push_back(digest);
+    // 这个条目的补丁来源已经先加进了 patchDigests
+    patchBegin.push_back(static_cast<unsigned>(patchDigests.size()));
+    return size() - 1;
+}
+
+void ManifestTable::addPatch(const Digest& digest) {
+    patchDigests.push_back(digest);
+}
+
+bool ManifestTable::fromJson(const QJsonObject& manifest, QString* error) {
+    clear();
+    auto fail = [&](const QString& reason) {
+        if (error) {
+            *error = reason;
+        }
+        clear();
+        return false;
+    };
+
+    if (manifest.isEmpty()) {
+        return fail("manifest is empty or not an object");
+    }
+    version = manifest["version"].toString().toStdString();
+    hash = manifest["hash"].toString().toStdString();
+    // 旧的版本信息里 hotfix 是字符串，缺少或不是数字时保持 -1
+    const QJsonValue hotfixValue = manifest["hotfix"];
+    if (hotfixValue.isDouble()) {
+        hotfix = hotfixValue.toInt(-1);
+    }
+    else {
+        bool ok = false;
+        int value = hotfixValue.toString().toInt(&ok);
+        if (ok) {
+            hotfix = value;
+        }
+    }
+    mainProgram = manifest["main_program"].toString().toStdString();
+    bundle = manifest["bundle"].toString().toStdString();
+
+    const QJsonArray files = manifest["files"].toArray();
+    nameEnd.reserve(files.size());
+    dirOf.reserve(files.size());
+    digests.reserve(files.size());
+    patchBegin.reserve(files.size() + 1);
+    for (const auto& value : files) {
+        const QJsonObject file = value.toObject();
+        Digest digest;
+        for (const auto& patchBase : file["patch_from"].toArray()) {
+            if (!parseHex(patchBase.toString().toStdString(), digest)) {
+                return fail("invalid patch_from hash");
+            }
+            addPatch(digest);
+        }
+        if (!parseHex(file["hash"].toString().toStdString(), digest)) {
+            return fail("invalid file hash");
+        }
+        append(file["filename"].toString().toStdString(), digest);
+    }
+    const QString missing = missingField();
+    if (!missing.isEmpty()) {
+        return fail("missing " + missing);
+    }
+    // 目录索引只在解析时用
+    std::unordered_map<std::string, unsigned>().swap(dirIndex);
+    return true;
+}
+
+bool ManifestTable::fromCbor(const QByteArray& data, QString* error) {
+    clear();
+    QCborStreamReader reader(data);
+    std::string key;
+    std::string text;
+    auto fail = [&](const QString& reason) {
+        if (error) {
+            *error = QString("%1 at offset %2").arg(reason).arg(reader.currentOffset());
+        }
+        clear();
+        return false;
+    };
+
+    if (!reader.isMap() || !reader.enterContainer()) {
+        return fail("manifest is not a map");
+    }
+    while (reader.hasNext()) {
+        if (!reader.isString() || !readString(reader, key)) {
+            return fail("invalid key");
+        }
+        if (key == "files") {
+            if (!reader.isArray()) {
+                return fail("files is not an array");
+            }
+            if (reader.isLengthKnown()) {
+                size_t count = static_cast<size_t>(qMin<quint64>(reader.length(), static_cast<quint64>(data.size())));
+                nameEnd.reserve(count);
+                dirOf.reserve(count);
+                digests.reserve(count);
+                patchBegin.reserve(count + 1);
+            }
+            reader.enterContainer();
+            while (reader.hasNext()) {
+                if (!reader.isMap() || !reader.enterContainer()) {
+                    return fail("file entry is not a map");
+                }
+                bool hasName = false;
+                bool hasHash = false;
+                Digest digest;
+                while (reader.hasNext()) {
+                    if (!reader.isString() || !readString(reader, key)) {
+                        return fail("invalid key");
+                    }
+                    if (key == "filename") {
+                        if (!reader.isString() || !readString(reader, text)) {
+                            return fail("invalid filename");
+                        }
+                        hasName = true;
+                    }
+                    else if (key == "hash") {
+                        if (!readDigest(reader, key, digest)) {
+                            return fail("invalid file hash");
+                        }
+                        hasHash = true;
+                    }
+                    else if (key == "patch_from") {
+                        if (!reader.isArray() || !reader.enterContainer()) {
+                            return fail("patch_from is not an array");
+                        }
+                        Digest patchBase;
+                        while (reader.hasNext()) {
+                            if (!readDigest(reader, key, patchBase)) {
+                                return fail("invalid patch_from hash");
+                            }
+                            addPatch(patchBase);
+                        }
+                        reader.leaveContainer();
+                    }
+                    else {
+                        reader.next();
+                    }
+                }
+                reader.leaveContainer();
+                if (!hasName || !hasHash) {
+                    return fail("file entry without filename or hash");
+                }
+                append(text, digest);
+            }
+            reader.leaveContainer();
+        }
+        else if (key == "hotfix") {
+            if (reader.isUnsignedInteger()) {
+                hotfix = static_cast<int>(qMin<quint64>(reader.toUnsignedInteger(), INT_MAX));
+                reader.next();
+            }
+            else if (reader.isString() && readString(reader, text)) {
+                bool ok = false;
+                hotfix = QByteArray::fromStdString(text).toInt(&ok);
+                if (!ok) {
+                    return fail("invalid hotfix");
+                }
+            }
+            else {
+                return fail("invalid hotfix");
+            }
+        }
+        else if (key == "hash") {
+            // 只发布热更新时安装包哈希可能为空，和 JSON 一样当作没有
+            Digest digest;
+            if (reader.isString()) {
+                if (!readString(reader, text) || (!text.empty() && !parseHex(text, digest))) {
+                    return fail("invalid hash");
+                }
+                hash = text.empty() ? std::string() : toHex(digest);
+            }
+            else if (readDigest(reader, text, digest)) {
+                hash = toHex(digest);
+            }
+            else {
+                return fail("invalid hash");
+            }
+        }
+        else if (key == "version" || key == "main_program" || key == "bundle") {
+            std::string& target = key == "version" ? version : key == "main_program" ? mainProgram : bundle;
+            if (!reader.isString() || !readString(reader, target)) {
+                return fail("invalid " + QString::fromStdString(key));
+            }
+        }
+        else {
+            reader.next();
+        }
+    }
+    reader.leaveContainer();
+    if (reader.lastError() != QCborError::NoError) {
+        return fail(reader.lastError().toString());
+    }
+    const QString missing = missingField();
+    if (!missing.isEmpty()) {
+        return fail("missing " + missing);
+    }
+    std::unordered_map<std::string, unsigned>().swap(dirIndex);
+    return true;
+}
+
+QString ManifestTable::missingField() const {
+    if (version.empty()) {
+        return "version";
+    }
+    if (mainProgram.empty()) {
+        return "main_program";
+    }
+    if (hotfix < 0) {
+        return "hotfix";
+    }
+    return QString();
+}
+
+QJsonObject ManifestTable::toJson() const {
+    QJsonObject manifest;
+    manifest["version"] = QString::fromStdString(version);
+    manifest["hash"] = QString::fromStdString(hash);
+    manifest["hotfix"] = QString::number(hotfix);
+    manifest["main_program"] = QString::fromStdString(mainProgram);
+    if (!bundle.empty()) {
+        manifest["bundle"] = QString::fromStdString(bundle);
+    }
+    QJsonArray files;
+    for (int i = 0; i < size(); ++i) {
+        QJsonObject file;
+        file["filename"] = filePath(i);
+        file["hash"] = QString::fromStdString(hexDigest(i));
+        if (patchCount(i) > 0) {
+            QJsonArray patchFrom;
+            for (int k = 0; k < patchCount(i); ++k) {
+                patchFrom.append(QString::fromStdString(toHex(patchDigest(i, k))));
+            }
+            file["patch_from"] = patchFrom;
+        }
+        files.append(file);
+    }
+    manifest["files"] = files;
+    return manifest;
+}
+
+QByteArray ManifestTable::cborFromJson(const QJsonObject& manifest) {
+    QByteArray data;
+    QCborStreamWriter writer(&data);
+    Digest digest;
+    auto appendDigest = [&writer, &digest](const QString& hex) {
+        if (parseHex(hex.toStdString(), digest)) {
+            writer.appendByteString(reinterpret_cast<const char*>(digest.data()), DIGEST_SIZE);
+        }
+        else {
+            writer.append(hex);
+        }
+    };
+
+    writer.startMap();
+    for (const char* key : { "version", "main_program", "bundle" }) {
+        if (manifest.contains(QLatin1String(key))) {
+            writer.append(QLatin1String(key));
+            writer.append(manifest[QLatin1String(key)].toString());
+        }
+    }
+    const QString installerHash = manifest["hash"].toString();
+    if (!installerHash.isEmpty()) {
+        writer.append(QLatin1String("hash"));
+        appendDigest(installerHash);
+    }
+    writer.append(QLatin1String("hotfix"));
+    const QJsonValue hotfixValue = manifest["hotfix"];
+    writer.append(static_cast<quint64>(qMax(0, hotfixValue.isDouble() ? hotfixValue.toInt() : hotfixValue.toString().toInt())));
+
+    const QJsonArray files = manifest["files"].toArray();
+    writer.append(QLatin1String("files"));
+    writer.startArray(files.size());
+    for (const auto& value : files) {
+        const QJsonObject file = value.toObject();
+        const QJsonArray patchFrom = file["patch_from"].toArray();
+        writer.startMap(patchFrom.isEmpty() ? 2 : 3);
+        writer.append(QLatin1String("filename"));
+        writer.append(file["filename"].toString());
+        writer.append(QLatin1String("hash"));
+        appendDigest(file["hash"].toString());
+        if (!patchFrom.isEmpty()) {
+            writer.append(QLatin1String("patch_from"));
+            writer.startArray(patchFrom.size());
+            for (const auto& patchBase : patchFrom) {
+                appendDigest(patchBase.toString());
+            }
+            writer.endArray();
+        }
+        writer.endMap();
+    }
+    writer.endArray();
+    writer.endMap();
+    return data;
+}
+
+bool ManifestTable::parseHex(std::string_view hex, Digest& digest) {
+    if (hex.size() != DIGEST_SIZE * 2) {
+        return false;
+    }
+    for (int k = 0; k < DIGEST_SIZE; ++k) {
+        int high = hexValue(static_cast<unsigned char>(hex[2 * k]));
+        int low = hexValue(static_cast<unsigned char>(hex[2 * k + 1]));
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        digest[k] = static_cast<unsigned char>((high << 4) | low);
+    }
+    return true;
+}
+
+std::string ManifestTable::toHex(const Digest& digest) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex(DIGEST_SIZE * 2, '0');
+    for (int k = 0; k < DIGEST_SIZE; ++k) {
+        hex[2 * k] = digits[digest[k] >> 4];
+        hex[2 * k + 1] = digits[digest[k] & 0xf];
+    }
+    return hex;
+}
@@ -0,0 +1,98 @@
+﻿#pragma once
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <QByteArray>
+#include <QJsonObject>
+#include <QString>
+
+
+// 热更新文件的信息，下载、打包、提交等流程按文件处理时使用
+// 版本信息里的全部文件保存在 ManifestTable 中，只有需要处理的文件才展开成 FileInfo
+struct FileInfo {
+    std::string filename;
+    std::string hash;
+    // 服务器为哪些旧版本（旧文件哈希）发布了到该版本的差分补丁
+    std::vector<std::string> patchFrom;
+};
+
+// ======================
+// 版本信息文件表
+// ======================
+// 版本信息按列存放（struct of arrays），每个条目不单独分配内存：
+//   - 路径拆成目录和文件名，目录去重后只存一份，文件名依次拼接在一个缓冲区里
+//   - 哈希存成16字节的MD5原始值，而不是32个字符的hex字符串
+//   - patch_from 也按列存放，条目 i 的补丁来源是 patchDigests[patchBegin[i], patchBegin[i+1])
+// 可以从 JSON 版本信息转换，也可以流式解析 CBOR 版本信息（Content-Type: application/cbor）：
+//   { "version": text, "hash": bytes(16), "hotfix": uint, "main_program": text, "bundle": text,
+//     "files": [ { "filename": text, "hash": bytes(16), "patch_from": [ bytes(16), ... ] }, ... ] }
+// 哈希字段也接受 hex 文本，顶层的安装包 hash 可以没有或为空文本，未知字段跳过；缺少 version、main_program 或 hotfix 时两种格式都解析失败
+class ManifestTable {
+public:
+    static constexpr int DIGEST_SIZE = 16;
+    using Digest = std::array<unsigned char, DIGEST_SIZE>;
+
+    // 安装包和热更新的版本信息
+    std::string version;
+    std::string hash;
+    int hotfix = -1;
+    std::string mainProgram;
+    std::string bundle;
+
+    void clear();
+
+    int size() const;
+    // 条目 i 的相对路径
+    std::string path(int i) const;
+    QString filePath(int i) const;
+    const Digest& digest(int i) const;
+    std::string hexDigest(int i) const;
+    // 条目 i 的哈希和 hex 形式的 hash 是否一致（不区分大小写）
+    bool digestMatches(int i, const QString& hex) const;
+    int patchCount(int i) const;
+    const Digest& patchDigest(int i, int k) const;
+    // 不同内容（哈希）的文件数
+    int distinctDigests() const;
+
+    // 展开成 FileInfo，只对需要处理的条目调用
+    FileInfo fileInfo(int i) const;
+
+    // 表本身占用的内存（字节，按容量计），用于基准测试
+    size_t memoryBytes() const;
+    // 字符串在堆上占用的字节数，短字符串存在对象内部时为0
+    static size_t heapBytes(const std::string& text);
+
+    // 解析失败时 error 说明原因
+    bool fromJson(const QJsonObject& manifest, QString* error = nullptr);
+    // 流式解析 CBOR 版本信息
+    bool fromCbor(const QByteArray& data, QString* error = nullptr);
+    // 转回 JSON 版本信息，写缓存和后台准备好的更新标记时使用
+    QJsonObject toJson() const;
+    // 把 JSON 版本信息编码成 CBOR，服务器端和基准测试使用
+    static QByteArray cborFromJson(const QJsonObject& manifest);
+
+    static bool parseHex(std::string_view hex, Digest& digest);
+    static std::string toHex(const Digest& digest);
+
+private:
+    // 追加一个条目，返回它的下标；路径按最后一个 '/' 拆成目录和文件名
+    int append(std::string_view path, const Digest& digest);
+    void addPatch(const Digest& digest);
+    // 后续流程必需的顶层字段中第一个缺少的，都有时为空
+    QString missingField() const;
+
+    std::vector<std::string> dirs;                          // 去重后的目录，含末尾的 '/'，0 号是根目录
+    std::unordered_map<std::string, unsigned> dirIndex;     // 目录 -> dirs 下标
+    std::string dirKey;                                     // 查找目录时复用的缓冲区
+
+    std::string names;                  // 所有文件名依次拼接
+    std::vector<unsigned> nameEnd;      // 条目 i 的文件名是 names[nameEnd[i-1], nameEnd[i])
+    std::vector<unsigned> dirOf;
+    std::vector<Digest> digests;
+    std::vector<unsigned> patchBegin{ 0 };
+    std::vector<Digest> patchDigests;
+};
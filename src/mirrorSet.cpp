@@ -0,0 +1,110 @@
+﻿#include "mirrorSet.h"
+#include "httpClient.h"
+
+#include <algorithm>
+#include <memory>
+
+#include <QPointer>
+#include <QTimer>
+
+#include <QDebug>
+
+
+MirrorSet::MirrorSet(const QStringList& baseUrls) {
+    for (const QString& baseUrl : baseUrls) {
+        QString trimmed = baseUrl.trimmed();
+        while (trimmed.endsWith('/')) {
+            trimmed.chop(1);
+        }
+        bool duplicate = std::any_of(mirrors.begin(), mirrors.end(), [&trimmed](const Mirror& mirror) {
+            return mirror.baseUrl == trimmed;
+        });
+        if (!trimmed.isEmpty() && !duplicate) {
+            Mirror mirror;
+            mirror.baseUrl = trimmed;
+            mirrors.push_back(mirror);
+        }
+    }
+}
+
+int MirrorSet::size() const {
+    return static_cast<int>(mirrors.size());
+}
+
+void MirrorSet::probe(int timeoutMs, std::function<void()> done) {
+    if (mirrors.size() <= 1) {
+        done();
+        return;
+    }
+
+    // 所有探测共享的状态，最后一个结束的探测负责排序并回调
+    struct Probe {
+        int pending = 0;
+        std::function<void()> done;
+    };
+    auto probe = std::make_shared<Probe>();
+    probe->pending = static_cast<int>(mirrors.size());
+    probe->done = std::move(done);
+
+    for (size_t i = 0; i < mirrors.size(); ++i) {
+        HTTPRequest request(HTTP_HEAD, mirrors[i].baseUrl + "/api/updater/version");
+        HTTPTransfer* transfer = HTTPClient::getInstance().sendAsync(request, [this, i, probe](HTTPResponse& response) {
+            Mirror& mirror = mirrors[i];
+            bool reachable = response.error_code == QNetworkReply::NetworkError::NoError && response.is_Status_2xx();
+            mirror.latencyMs = reachable ? response.headers_ms : -1;
+            qDebug() << "Mirror probed: " << mirror.baseUrl
+                << (reachable ? QString("%1 ms").arg(mirror.latencyMs) : "unreachable: " + response.error_string);
+
+            if (--probe->pending == 0) {
+                sort();
+                qDebug() << "Selected mirror: " << current();
+                probe->done();
+            }
+        });
+        // 超时的探测直接中止，仍然会走到上面的完成回调
+        QPointer<HTTPTransfer> guard(transfer);
+        QTimer::singleShot(timeoutMs, transfer, [guard]() {
+            if (guard) {
+                guard->abort();
+            }
+        });
+    }
+}
+
+QString MirrorSet::current() const {
+    return mirrors.empty() ? QString() : mirrors.front().baseUrl;
+}
+
+QString MirrorSet::alternate() const {
+    return mirrors.size() < 2 ? current() : mirrors[1].baseUrl;
+}
+
+QString MirrorSet::url(const QString& path) const {
+    return current() + path;
+}
+
+bool MirrorSet::reportFailure(const QString& baseUrl, const QString& reason) {
+    if (mirrors.size() <= 1) {
+        return false;
+    }
+    for (Mirror& mirror : mirrors) {
+        if (mirror.baseUrl == baseUrl) {
+            ++mirror.failures;
+        }
+    }
+    sort();
+    qDebug() << "Mirror failed (" << reason << "): " << baseUrl << " switching to: " << current();
+    return true;
+}
+
+void MirrorSet::sort() {
+    std::stable_sort(mirrors.begin(), mirrors.end(), [](const Mirror& a, const Mirror& b) {
+        if (a.failures != b.failures) {
+            return a.failures < b.failures;
+        }
+        if ((a.latencyMs < 0) != (b.latencyMs < 0)) {
+            return b.latencyMs < 0;
+        }
+        return a.latencyMs < b.latencyMs;
+    });
+}
@@ -0,0 +1,48 @@
+﻿#pragma once
+
+#include <functional>
+#include <vector>
+
+#include <QString>
+#include <QStringList>
+
+
+// ======================
+// 更新服务器镜像
+// ======================
+// 维护一组内容相同的更新服务器，按探测到的响应时间和出错次数排序，请求总是发往排在最前面的镜像
+// 文件的完整性只由版本信息里的哈希保证，镜像本身不需要可信
+// 不是线程安全的，和 Updater 在同一个线程中使用
+class MirrorSet {
+public:
+    explicit MirrorSet(const QStringList& baseUrls);
+
+    int size() const;
+
+    // 并发向所有镜像发 HEAD 请求，按收到响应头的时间排序，timeoutMs 内没有响应或出错的镜像排到最后
+    // 只有一个镜像时不探测，直接回调
+    void probe(int timeoutMs, std::function<void()> done);
+
+    // 当前最优的镜像地址
+    QString current() const;
+    // 排在第二位的镜像，用于对冲请求；只有一个镜像时和 current() 相同
+    QString alternate() const;
+    // 当前最优镜像上 path 对应的完整地址，path 以 '/' 开头
+    QString url(const QString& path) const;
+
+    // 报告镜像出错或太慢，它会排到出错次数更少的镜像之后
+    // 返回false表示只有这一个镜像，换不了
+    bool reportFailure(const QString& baseUrl, const QString& reason);
+
+private:
+    struct Mirror {
+        QString baseUrl;
+        qint64 latencyMs = -1;  // 探测到的响应时间，-1 表示未探测或不可达
+        int failures = 0;
+    };
+
+    // 出错次数少的在前，其次是响应快的，不可达的最后
+    void sort();
+
+    std::vector<Mirror> mirrors;
+};
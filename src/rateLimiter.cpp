@@ -0,0 +1,198 @@
+﻿#include "rateLimiter.h"
+
+#include <QElapsedTimer>
+#include <QtGlobal>
+
+#include <QDebug>
+
+
+// 共享内存的键，同一台机器上的更新器实例都用这个键
+static const char* SHARED_KEY = "updater.rate_limiter.v1";
+static const quint32 BUCKET_MAGIC = 0x524C4D31;     // "RLM1"
+// 桶容量（允许的突发）对应的时长，以及最小容量
+static const qint64 BURST_MS = 250;
+static const qint64 MIN_BURST_BYTES = 16 * 1024;
+// 首字节延迟超过基线的倍数、并且至少高出这么多毫秒，才认为链路在排队
+static const double INFLATION_FACTOR = 2.0;
+static const qint64 INFLATION_MIN_MS = 50;
+// 两次减速之间至少间隔的时间，避免同一时刻的多个样本把速率连续砍掉
+static const qint64 DECREASE_INTERVAL_MS = 1000;
+static const double DECREASE_FACTOR = 0.7;
+// 每个正常样本增加的速率：最大速率的 1/50，至少 16KiB/s
+static const qint64 MIN_INCREASE = 16 * 1024;
+// 基线在样本高于它时缓慢上移，路由变化后基线能跟上
+static const qint64 BASELINE_DRIFT = 32;
+
+
+RateLimiter& RateLimiter::getInstance() {
+    static RateLimiter instance;
+    return instance;
+}
+
+RateLimiter::Locker::Locker(RateLimiter& limiter)
+    : limiter(limiter)
+{
+    limiter.mutex.lock();
+    if (limiter.sharedMemory.isAttached()) {
+        limiter.sharedMemory.lock();
+    }
+}
+
+RateLimiter::Locker::~Locker() {
+    if (limiter.sharedMemory.isAttached()) {
+        limiter.sharedMemory.unlock();
+    }
+    limiter.mutex.unlock();
+}
+
+RateLimiter::Bucket& RateLimiter::Locker::bucket() {
+    Bucket* bucket = limiter.sharedMemory.isAttached()
+        ? static_cast<Bucket*>(limiter.sharedMemory.data())
+        : &limiter.localBucket;
+    // 共享内存刚创建时内容未初始化，第一个拿到锁的进程负责初始化
+    if (bucket->magic != BUCKET_MAGIC) {
+        limiter.initBucket(*bucket);
+    }
+    return *bucket;
+}
+
+qint64 RateLimiter::nowMs() {
+    // 单调时钟的参考点是系统启动，不同进程之间可以直接比较
+    QElapsedTimer timer;
+    timer.start();
+    return timer.msecsSinceReference();
+}
+
+void RateLimiter::initBucket(Bucket& bucket) const {
+    bucket.magic = BUCKET_MAGIC;
+    bucket.rate = settings.maxRate;
+    bucket.tokens = 0;
+    bucket.lastRefillMs = nowMs();
+    bucket.baselineMs = -1;
+    bucket.lastDecreaseMs = 0;
+}
+
+void RateLimiter::configure(const Settings& settings) {
+    QMutexLocker locker(&mutex);
+    this->settings = settings;
+    this->settings.maxRate = qMax<qint64>(0, settings.maxRate);
+    this->settings.minRate = qBound<qint64>(1, settings.minRate, this->settings.maxRate > 0 ? this->settings.maxRate : 1);
+    localBucket.magic = 0;
+
+    if (sharedMemory.isAttached()) {
+        sharedMemory.detach();
+    }
+    if (enabled() && settings.shared) {
+        sharedMemory.setKey(SHARED_KEY);
+        if (!sharedMemory.create(sizeof(Bucket)) && !sharedMemory.attach()) {
+            qDebug() << "Shared rate limiter unavailable, limiting this process only: " << sharedMemory.errorString();
+        }
+    }
+    locker.unlock();
+
+    if (!enabled()) {
+        return;
+    }
+    Locker bucketLocker(*this);
+    Bucket& bucket = bucketLocker.bucket();
+    // 其他实例已经在用共享的桶时：固定速率以本次配置为准，自适应速率保留当前值，只夹到新的范围里
+    bucket.rate = settings.adaptive
+        ? qBound(this->settings.minRate, bucket.rate, this->settings.maxRate)
+        : this->settings.maxRate;
+    qDebug() << "Download rate limit (bytes/s): " << bucket.rate
+        << " adaptive: " << settings.adaptive
+        << " shared: " << sharedMemory.isAttached();
+}
+
+bool RateLimiter::enabled() const {
+    return settings.maxRate > 0;
+}
+
+qint64 RateLimiter::currentRate() {
+    if (!enabled()) {
+        return 0;
+    }
+    Locker locker(*this);
+    return locker.bucket().rate;
+}
+
+qint64 RateLimiter::capacity(const Bucket& bucket) const {
+    return qMax(MIN_BURST_BYTES, bucket.rate * BURST_MS / 1000);
+}
+
+void RateLimiter::refill(Bucket& bucket, qint64 now) const {
+    qint64 elapsed = now - bucket.lastRefillMs;
+    if (elapsed <= 0) {
+        return;
+    }
+    bucket.tokens = qMin<double>(capacity(bucket), bucket.tokens + static_cast<double>(bucket.rate) * elapsed / 1000.0);
+    bucket.lastRefillMs = now;
+}
+
+qint64 RateLimiter::acquire(qint64 wanted) {
+    if (!enabled() || wanted <= 0) {
+        return wanted;
+    }
+    Locker locker(*this);
+    Bucket& bucket = locker.bucket();
+    refill(bucket, nowMs());
+    qint64 granted = qBound<qint64>(0, static_cast<qint64>(bucket.tokens), wanted);
+    bucket.tokens -= granted;
+    return granted;
+}
+
+int RateLimiter::waitMs(qint64 wanted) {
+    if (!enabled()) {
+        return 0;
+    }
+    Locker locker(*this);
+    Bucket& bucket = locker.bucket();
+    refill(bucket, nowMs());
+    double missing = qMin<double>(wanted, capacity(bucket)) - bucket.tokens;
+    if (missing <= 0) {
+        return 0;
+    }
+    return qMax(1, static_cast<int>(missing * 1000.0 / bucket.rate));
+}
+
+void RateLimiter::consume(qint64 bytes) {
+    if (!enabled() || bytes <= 0) {
+        return;
+    }
+    Locker locker(*this);
+    Bucket& bucket = locker.bucket();
+    refill(bucket, nowMs());
+    bucket.tokens -= bytes;
+}
+
+void RateLimiter::reportLatency(qint64 ms) {
+    if (!enabled() || !settings.adaptive || ms < 0) {
+        return;
+    }
+    Locker locker(*this);
+    Bucket& bucket = locker.bucket();
+
+    if (bucket.baselineMs < 0 || ms < bucket.baselineMs) {
+        bucket.baselineMs = ms;
+    }
+    else {
+        bucket.baselineMs += (ms - bucket.baselineMs) / BASELINE_DRIFT;
+    }
+
+    const qint64 now = nowMs();
+    bool inflated = ms > bucket.baselineMs * INFLATION_FACTOR && ms - bucket.baselineMs > INFLATION_MIN_MS;
+    if (inflated) {
+        if (now - bucket.lastDecreaseMs < DECREASE_INTERVAL_MS) {
+            return;
+        }
+        bucket.lastDecreaseMs = now;
+        qint64 rate = qMax(settings.minRate, static_cast<qint64>(bucket.rate * DECREASE_FACTOR));
+        if (rate != bucket.rate) {
+            qDebug() << "Latency inflated (" << ms << "ms, baseline" << bucket.baselineMs
+                << "ms), download rate lowered to " << rate << " bytes/s";
+        }
+        bucket.rate = rate;
+        return;
+    }
+    bucket.rate = qMin(settings.maxRate, bucket.rate + qMax(MIN_INCREASE, settings.maxRate / 50));
+}
@@ -0,0 +1,78 @@
+﻿#pragma once
+
+#include <QMutex>
+#include <QSharedMemory>
+
+
+// ======================
+// 下载限速（令牌桶）
+// ======================
+// 进程内所有线程的流式下载共用一个令牌桶，令牌按当前速率补充，读取响应体之前先取令牌
+// 令牌不够时暂时不从 QNetworkReply 读数据，Qt 的读缓冲区满后由 TCP 流控让服务器放慢发送，
+// 所以限制的是真正的网络带宽，而不只是写盘速度
+// 共享模式下令牌桶放在系统共享内存里，同一台机器上的所有更新器实例共用一个速率
+// 自适应模式下按请求的首字节延迟调整速率：延迟明显高于历史基线说明出口链路已经排队，
+// 速率乘性减小；否则加性增大，在 [minRate, maxRate] 之间变化（AIMD）
+class RateLimiter {
+public:
+    struct Settings {
+        qint64 maxRate = 0;             // 字节/秒，0 表示不限速
+        qint64 minRate = 64 * 1024;     // 自适应模式下速率的下限
+        bool adaptive = false;
+        bool shared = false;
+    };
+
+    static RateLimiter& getInstance();
+
+    // 应用配置，可以重复调用；共享模式下连接（或创建）共享的令牌桶
+    void configure(const Settings& settings);
+
+    bool enabled() const;
+    // 当前生效的速率（字节/秒），不限速时返回0
+    qint64 currentRate();
+
+    // 取最多 wanted 字节的令牌，返回现在可以读取的字节数，可能为0；不限速时直接返回 wanted
+    qint64 acquire(qint64 wanted);
+    // 令牌为0时，攒够 wanted 字节（不超过桶容量）还需要等待的毫秒数
+    int waitMs(qint64 wanted);
+    // 不管令牌是否足够都记账，允许欠账，用于传输结束时必须读完的数据
+    void consume(qint64 bytes);
+
+    // 报告一次请求从发出到收到响应头的耗时，自适应模式下据此调整速率
+    void reportLatency(qint64 ms);
+
+private:
+    RateLimiter() = default;
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    // 令牌桶状态，共享模式下位于共享内存中，只能是简单的平铺数据
+    struct Bucket {
+        quint32 magic;
+        qint64 rate;            // 当前速率，字节/秒
+        double tokens;          // 可以为负，表示欠账
+        qint64 lastRefillMs;    // 系统范围的单调时钟
+        qint64 baselineMs;      // 首字节延迟的基线，-1 表示还没有样本
+        qint64 lastDecreaseMs;
+    };
+
+    // 持有进程内的互斥锁，共享模式下同时持有共享内存的锁
+    class Locker {
+    public:
+        explicit Locker(RateLimiter& limiter);
+        ~Locker();
+        Bucket& bucket();
+    private:
+        RateLimiter& limiter;
+    };
+
+    void initBucket(Bucket& bucket) const;
+    void refill(Bucket& bucket, qint64 nowMs) const;
+    qint64 capacity(const Bucket& bucket) const;
+    static qint64 nowMs();
+
+    QMutex mutex;
+    Settings settings;
+    Bucket localBucket{};
+    QSharedMemory sharedMemory;
+};
@@ -0,0 +1,143 @@
+﻿#include "updateMetrics.h"
+#include "httpClient.h"
+
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QSaveFile>
+
+#include <QDebug>
+
+
+// 字节数和毫秒数换算成每秒字节数，耗时为0时按1毫秒算
+static qint64 bytesPerSecond(qint64 bytes, qint64 ms) {
+    return bytes * 1000 / qMax<qint64>(ms, 1);
+}
+
+void UpdateMetrics::start() {
+    clock.start();
+    startedAt = QDateTime::currentDateTimeUtc();
+    phases.clear();
+    requests.clear();
+    files.clear();
+    pool = QJsonObject();
+}
+
+void UpdateMetrics::beginPhase(const QString& name) {
+    endPhase();
+    Phase phase;
+    phase.name = name;
+    phase.startMs = clock.elapsed();
+    phases.push_back(phase);
+}
+
+void UpdateMetrics::endPhase() {
+    if (!phases.empty() && phases.back().durationMs < 0) {
+        phases.back().durationMs = clock.elapsed() - phases.back().startMs;
+    }
+}
+
+void UpdateMetrics::recordRequest(const QString& url, const HTTPResponse& response) {
+    Request request;
+    request.url = url;
+    request.statusCode = response.status_code;
+    request.errorCode = static_cast<int>(response.error_code);
+    request.headersMs = response.headers_ms;
+    request.elapsedMs = response.elapsed_ms;
+    request.bytes = response.bytes_received;
+    request.contentEncoding = response.content_encoding;
+    requests.push_back(request);
+}
+
+void UpdateMetrics::recordFile(const FileStats& file) {
+    files.push_back(file);
+}
+
+void UpdateMetrics::recordPool(const HTTPPoolStats& stats) {
+    pool = QJsonObject();
+    pool["requests_started"] = stats.requests_started;
+    pool["requests_finished"] = stats.requests_finished;
+    pool["peak_in_flight"] = stats.peak_in_flight;
+    pool["http2_responses"] = stats.http2_responses;
+    pool["tls_handshakes"] = stats.tls_handshakes;
+    pool["preconnects"] = stats.preconnects;
+    pool["retries"] = stats.retries;
+}
+
+bool UpdateMetrics::save(const QString& path, bool success, const QString& message) {
+    endPhase();
+    qint64 totalMs = clock.isValid() ? clock.elapsed() : 0;
+
+    QJsonArray phaseArray;
+    for (const Phase& phase : phases) {
+        QJsonObject item;
+        item["name"] = phase.name;
+        item["start_ms"] = phase.startMs;
+        item["duration_ms"] = phase.durationMs;
+        phaseArray.append(item);
+    }
+
+    qint64 requestBytes = 0;
+    QJsonArray requestArray;
+    for (const Request& request : requests) {
+        QJsonObject item;
+        item["url"] = request.url;
+        item["status"] = request.statusCode;
+        item["error"] = request.errorCode;
+        item["headers_ms"] = request.headersMs;
+        item["elapsed_ms"] = request.elapsedMs;
+        item["bytes"] = request.bytes;
+        item["bytes_per_sec"] = bytesPerSecond(request.bytes, request.elapsedMs);
+        if (!request.contentEncoding.isEmpty()) {
+            item["content_encoding"] = request.contentEncoding;
+        }
+        requestArray.append(item);
+        requestBytes += request.bytes;
+    }
+
+    qint64 hashNs = 0;
+    qint64 writeNs = 0;
+    QJsonArray fileArray;
+    for (const FileStats& file : files) {
+        QJsonObject item;
+        item["filename"] = file.filename;
+        item["source"] = file.source;
+        item["ok"] = file.ok;
+        item["bytes_written"] = file.bytesWritten;
+        item["bytes_transferred"] = file.bytesTransferred;
+        item["elapsed_ms"] = file.elapsedMs;
+        item["bytes_per_sec"] = bytesPerSecond(file.bytesTransferred, file.elapsedMs);
+        item["hash_ms"] = file.hashNs / 1000000.0;
+        item["write_ms"] = file.writeNs / 1000000.0;
+        fileArray.append(item);
+        hashNs += file.hashNs;
+        writeNs += file.writeNs;
+    }
+
+    QJsonObject totals;
+    totals["requests"] = static_cast<qint64>(requests.size());
+    totals["files"] = static_cast<qint64>(files.size());
+    totals["bytes_received"] = requestBytes;
+    totals["bytes_per_sec"] = bytesPerSecond(requestBytes, totalMs);
+    totals["hash_ms"] = hashNs / 1000000.0;
+    totals["write_ms"] = writeNs / 1000000.0;
+
+    QJsonObject summary;
+    summary["started_at"] = startedAt.toString(Qt::ISODateWithMs);
+    summary["success"] = success;
+    summary["message"] = message;
+    summary["total_ms"] = totalMs;
+    summary["totals"] = totals;
+    summary["pool"] = pool;
+    summary["phases"] = phaseArray;
+    summary["requests"] = requestArray;
+    summary["files"] = fileArray;
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Failed to write metrics: " << path;
+        return false;
+    }
+    file.write(QJsonDocument(summary).toJson(QJsonDocument::Indented));
+    return file.commit();
+}
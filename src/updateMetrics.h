@@ -0,0 +1,73 @@
+﻿#pragma once
+
+#include <vector>
+
+#include <QString>
+#include <QElapsedTimer>
+#include <QDateTime>
+#include <QJsonObject>
+
+class HTTPResponse;
+struct HTTPPoolStats;
+
+
+// ======================
+// 更新过程的耗时统计
+// ======================
+// 记录一次 Updater::process() 中每个阶段的耗时、每个HTTP请求的耗时，
+// 以及每个文件的传输字节数、哈希和写盘耗时，结束时写成json文件，供统一收集分析
+// 时间全部用单调时钟（QElapsedTimer）测量，不受系统时间调整影响
+// 只在 Updater 所在的线程中使用，不加锁
+class UpdateMetrics {
+public:
+    // 单个文件的统计
+    struct FileStats {
+        QString filename;
+        QString source;             // download / resume / patch / bundle / segmented
+        bool ok = false;
+        qint64 bytesWritten = 0;    // 写入磁盘的字节数（解压/重建后）
+        qint64 bytesTransferred = 0;// 网络上收到的响应体字节数
+        qint64 elapsedMs = 0;       // 从发出请求到完成
+        qint64 hashNs = 0;          // 计算哈希的累计耗时
+        qint64 writeNs = 0;         // 写盘的累计耗时
+    };
+
+    // 开始新的一次统计，清空之前的记录
+    void start();
+
+    // 进入新阶段，同时结束上一个阶段
+    void beginPhase(const QString& name);
+    void endPhase();
+
+    void recordRequest(const QString& url, const HTTPResponse& response);
+    void recordFile(const FileStats& file);
+    // 记录本次运行结束时的连接池统计
+    void recordPool(const HTTPPoolStats& stats);
+
+    // 写出统计结果，会结束当前阶段
+    bool save(const QString& path, bool success, const QString& message);
+
+private:
+    struct Phase {
+        QString name;
+        qint64 startMs = 0;
+        qint64 durationMs = -1;
+    };
+
+    struct Request {
+        QString url;
+        int statusCode = 0;
+        int errorCode = 0;
+        qint64 headersMs = -1;
+        qint64 elapsedMs = 0;
+        qint64 bytes = 0;
+        QString contentEncoding;
+    };
+
+    QElapsedTimer clock;
+    QDateTime startedAt;
+    std::vector<Phase> phases;
+    std::vector<Request> requests;
+    std::vector<FileStats> files;
+    QJsonObject pool;
+};
@@ -1,22 +1,71 @@
 ﻿#include "updater.h"
 #include "httpClient.h"
+#include "deltaPatch.h"
+#include "hotfixBundle.h"
+#include "rateLimiter.h"
 
 #include <fstream>
+#include <map>
+#include <functional>
+#include <algorithm>
+#include <set>
 
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonArray>
 #include <QFile>
+#include <QCryptographicHash>
+#include <QPointer>
+#include <QDateTime>
+#include <QSaveFile>
+#include <QDir>
+#include <QFileInfo>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QTimer>
+#include <QFutureWatcher>
+#include <QtConcurrent>
 
 #include <QDebug>
 
+#ifdef Q_OS_WIN
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
 using namespace std;
 
-Updater::Updater(std::unique_ptr<VersionComparator> comparator, QObject* parent)
-    : comparator(std::move(comparator)), QObject(parent)
+Updater::Updater(std::unique_ptr<VersionComparator> comparator, UpdaterConfig config, QObject* parent)
+    : comparator(std::move(comparator)), config(std::move(config)), QObject(parent)
 {
     qDebug() << "Updater initialized with comparator: "
 			 << typeid(*this->comparator).name();
+
+    // HTTP 详情日志默认关闭，配置打开时才启用（也可以用 QT_LOGGING_RULES 打开）
+    if (this->config.logHttp) {
+        lcHttp().setEnabled(QtDebugMsg, true);
+    }
+    HTTPClient::debug_body_preview = this->config.logBodyPreview;
+    HTTPClient::default_connect_timeout_ms = this->config.connectTimeoutMs;
+    HTTPClient::default_idle_timeout_ms = this->config.idleTimeoutMs;
+    HTTPClient::default_max_retries = this->config.maxRetries;
+
+    // 限速对整个进程生效（共享模式下对整台机器），所有线程的下载共用
+    RateLimiter::Settings rateSettings;
+    rateSettings.maxRate = static_cast<qint64>(this->config.maxRateKb) * 1024;
+    rateSettings.minRate = static_cast<qint64>(this->config.minRateKb) * 1024;
+    rateSettings.adaptive = this->config.adaptiveRate;
+    rateSettings.shared = this->config.sharedRate;
+    RateLimiter::getInstance().configure(rateSettings);
+
+    // 不管流程从哪一步结束，都在这里写出耗时统计
+    connect(this, &Updater::finished, this, [this](bool success, const QString& message) {
+        // 连接池按线程统计，这里和请求在同一线程
+        metrics.recordPool(HTTPClient::getInstance().stats());
+        metrics.save(metricsFile, success, message);
+    });
 }
 
 Updater::~Updater()
@@ -24,6 +73,14 @@ Updater::~Updater()
     qDebug() << "Updater destroyed.";
 }
 
+void Updater::setCheckOnly(bool checkOnly) {
+    this->checkOnly = checkOnly;
+}
+
+void Updater::setVerify(bool verify) {
+    this->verify = verify;
+}
+
 // --- Helper Functions ---
 static int readLocalVersion(const string& path) {
     ifstream file(path);
@@ -35,26 +92,169 @@ static int readLocalVersion(const string& path) {
 static void writeLocalVersion(const string& path, const string& version) {
     ofstream(path) << version;
 }
+
+// 热更新提交日志和后台准备好的更新标记，用 QSaveFile 保证文件本身不会写一半
+static QJsonObject readStateFile(const QString& path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QJsonObject();
+    }
+    return QJsonDocument::fromJson(file.readAll()).object();
+}
+
+static bool writeStateFile(const QString& path, const QJsonObject& state) {
+    QDir().mkpath(QFileInfo(path).path());
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    file.write(QJsonDocument(state).toJson(QJsonDocument::Compact));
+    return file.commit();
+}
+
+static QString installerFileName(const std::string& version) {
+    return "iNE_Setup_" + QString::fromStdString(version) + ".exe";
+}
+
+// 剩余时间的说明文字，例如 "剩余约 3 分 20 秒"
+static QString formatEta(qint64 seconds) {
+    if (seconds < 60) {
+        return QString("剩余约 %1 秒").arg(qMax<qint64>(1, seconds));
+    }
+    if (seconds < 3600) {
+        return QString("剩余约 %1 分 %2 秒").arg(seconds / 60).arg(seconds % 60);
+    }
+    return QString("剩余约 %1 小时 %2 分").arg(seconds / 3600).arg(seconds % 3600 / 60);
+}
+
+// 按已经观察到的平均速率估算，限速时不超过当前限速（自适应限速刚降下来时平均值还偏高）
+static double effectiveRate(qint64 received, qint64 elapsedMs) {
+    if (received <= 0 || elapsedMs <= 0) {
+        return 0;
+    }
+    double rate = received * 1000.0 / elapsedMs;
+    qint64 limit = RateLimiter::getInstance().currentRate();
+    return limit > 0 ? qMin<double>(rate, limit) : rate;
+}
+
+// 先启动模式下后台准备更新时不和主程序抢资源
+static void lowerCurrentThreadPriority() {
+#ifdef Q_OS_WIN
+    // 同时降低线程的CPU、磁盘IO和内存优先级
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+#else
+    QThread::currentThread()->setPriority(QThread::LowestPriority);
+#endif
+}
+
+// 版本信息缓存：{ "etag", "last_modified", "fetched_at"(毫秒时间戳), "body"(版本信息json),
+//               "latencies"(最近几次请求的耗时，毫秒) }
+// 服务器返回的是 CBOR 时，原始内容以 base64 存在 "body_cbor" 中，代替 "body"
+static QJsonObject readManifestCache(const QString& path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QJsonObject();
+    }
+    return QJsonDocument::fromJson(file.readAll()).object();
+}
+
+static void writeManifestCache(const QString& path, const QJsonObject& cache) {
+    QFile file(path);
+    if (file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        file.write(QJsonDocument(cache).toJson(QJsonDocument::Compact));
+    }
+}
+
+static bool hasCachedManifest(const QJsonObject& cache) {
+    return !cache["body"].toObject().isEmpty() || !cache["body_cbor"].toString().isEmpty();
+}
+
+static bool readCachedManifest(const QJsonObject& cache, ManifestTable& table) {
+    if (cache.contains("body_cbor")) {
+        return table.fromCbor(QByteArray::fromBase64(cache["body_cbor"].toString().toLatin1()));
+    }
+    return table.fromJson(cache["body"].toObject());
+}
+
+// 对冲请求的等待时间取最近 MANIFEST_LATENCY_HISTORY 次耗时的百分位，样本太少时用默认值
+static const int MANIFEST_LATENCY_HISTORY = 20;
+static const int MANIFEST_HEDGE_MIN_SAMPLES = 5;
+static const int MANIFEST_HEDGE_DEFAULT_MS = 1000;
+static const int MANIFEST_HEDGE_MIN_MS = 50;
+
+static QJsonArray appendLatency(const QJsonArray& history, qint64 elapsedMs) {
+    QJsonArray updated;
+    for (int i = qMax(0, history.size() - MANIFEST_LATENCY_HISTORY + 1); i < history.size(); ++i) {
+        updated.append(history[i]);
+    }
+    updated.append(static_cast<double>(elapsedMs));
+    return updated;
+}
+
+static int hedgeDelayMs(const QJsonArray& history, int percentile) {
+    if (history.size() < MANIFEST_HEDGE_MIN_SAMPLES) {
+        return MANIFEST_HEDGE_DEFAULT_MS;
+    }
+    std::vector<qint64> samples;
+    samples.reserve(history.size());
+    for (const auto& value : history) {
+        samples.push_back(static_cast<qint64>(value.toDouble()));
+    }
+    std::sort(samples.begin(), samples.end());
+    size_t index = (samples.size() - 1) * percentile / 100;
+    return static_cast<int>(qMax<qint64>(MANIFEST_HEDGE_MIN_MS, samples[index]));
+}
 // --- End Helper Functions ---
 
 void Updater::process() {
+    metrics.start();
+    // 本地恢复和检查期间先把到服务器的连接建好，获取版本信息时直接复用
+    // 有多个镜像时由探测请求建立连接
+    if (mirrors.size() == 1) {
+        HTTPClient::getInstance().preconnect(QUrl(mirrors.current()));
+    }
+    metrics.beginPhase("recover");
+    localIndex.load();
+
+    // 上次提交热更新时被打断（断电、强制结束），先把安装目录恢复到一致状态
+    recoverInterruptedCommit();
+
+    // 先启动模式：提交上次在后台准备好的更新，然后立即启动主程序，检查和下载都放到后台
+    // 校验模式要修复的文件可能正被主程序占用，不提前启动
+    if (config.launchFirst && !checkOnly && !verify) {
+        if (applyStagedUpdate()) {
+            emit finished(true, "新版本安装包已就绪，请按提示进行安装。");
+            return;
+        }
+        launchBeforeCheck();
+    }
+
     // 1. 获取远程版本信息
+    // 网络请求全部是异步的，process() 发出请求后立即返回，
+    // 后续步骤在工作线程的事件循环中以回调的方式继续
     emit progressChanged(10, "正在连接服务器，获取版本信息...");
-    if (!getRemoteVersion()) {
-        emit finished(false, "获取远程版本信息失败，请检查网络。");
-        return;
-    }
+    metrics.beginPhase("manifest");
+    getRemoteVersion([this](bool ok) {
+        if (!ok) {
+            emit finished(false, "获取远程版本信息失败，请检查网络。");
+            return;
+        }
+        checkForUpdates();
+    });
+}
 
+void Updater::checkForUpdates() {
     assert(!mainProgram.empty() && "Main program path is empty");
     assert(!remoteInstallerVersion.empty() && "Remote installer version is empty");
     assert((remotehotfixVersion != -1) && "Remote hotfix version is empty");
 
     // 2. 检查大版本安装包更新
+    metrics.beginPhase("compare");
     emit progressChanged(20, "正在比较软件版本...");
     // 当本地版本号大于远程版本号，表示正在使用特殊版本，不再检查任何更新
     if (comparator->isNewer(installerVersion, remoteInstallerVersion)) {
         qDebug() << "Current version is newer than remote version, skipping installer update.";
-        emit launchProgramRequested(QString::fromStdString(mainProgram));
+        requestProgramLaunch();
         emit finished(true, "当前版本已是最新，无需更新。");
         return;
     }
@@ -64,20 +264,49 @@ void Updater::process() {
             << QString::fromStdString(remoteInstallerVersion)
             << " (local: " << QString::fromStdString(installerVersion) << ")";
 
+        if (checkOnly) {
+            emit updateAvailable("installer", QString::fromStdString(remoteInstallerVersion));
+            emit finished(true, "发现新版本安装包。");
+            return;
+        }
+
         // 拼接安装包名称
-        QString installerName = "iNE_Setup_" +
-            QString::fromStdString(remoteInstallerVersion) + ".exe";
+        QString installerName = installerFileName(remoteInstallerVersion);
+
+        // 下载并应用安装包更新，本地已有校验通过的安装包时直接使用
+        if (localIndex.matches(installerName, installerHash)) {
+            qDebug() << "Installer already downloaded and verified: " << installerName;
+            localIndex.save();
+            if (launchedEarly) {
+                writeStagedUpdate("installer");
+                emit finished(true, "新版本安装包已下载，下次启动时安装。");
+                return;
+            }
+            emit launchInstallerRequested(installerName);
+            emit finished(true, "新版本安装包已就绪，请按提示进行安装。");
+            return;
+        }
 
-        // 下载并应用安装包更新
         emit progressChanged(30, "发现新版本，准备下载安装包...");
-        if (!downloadAndPrepareInstaller(installerName)) {
-            emit finished(false, "下载或验证安装包失败。");
-			return;
-		}
+        metrics.beginPhase("download");
+        downloadAndPrepareInstaller(installerName, [this, installerName](bool ok) {
+            localIndex.save();
+            if (!ok) {
+                emit finished(false, "下载或验证安装包失败。");
+                return;
+            }
 
-        // 安装包准备就绪，发出信号通知UI层处理
-        emit launchInstallerRequested(installerName);
-        emit finished(true, "新版本安装包已就绪，请按提示进行安装。");
+            // 主程序已经在运行，不打断用户，下次启动时再安装
+            if (launchedEarly) {
+                writeStagedUpdate("installer");
+                emit finished(true, "新版本安装包已下载，下次启动时安装。");
+                return;
+            }
+
+            // 安装包准备就绪，发出信号通知UI层处理
+            emit launchInstallerRequested(installerName);
+            emit finished(true, "新版本安装包已就绪，请按提示进行安装。");
+        });
         return;
     }
     else {
@@ -85,153 +314,1728 @@ void Updater::process() {
         emit progressChanged(30, "当前为最新版本，正在检查热更新...");
 	}
 
+    // 安装包是最新的，版本信息里的文件列表才对应本地安装目录，这时才能校验
+    if (verify) {
+        verifyHotfixFiles([this](bool ok) {
+            if (!ok) {
+                emit finished(false, "校验本地文件失败。");
+                return;
+            }
+            checkHotfix();
+        });
+        return;
+    }
+    checkHotfix();
+}
+
+void Updater::checkHotfix() {
     // 3. 检查热更新 自动文件替换
     // 读取本地 hotfix版本号
     int localhotfixVersion = readLocalVersion(hotfixVersionFile);
 
-    if (remotehotfixVersion <= localhotfixVersion) {
+    // 本地版本号大于远程版本号，表示正在使用特殊版本，和安装包一样不更新；
+    // 只有配置允许时才把服务器版本号变小当作回滚
+    bool rollback = remotehotfixVersion < localhotfixVersion && config.allowRollback;
+    bool repair = remotehotfixVersion == localhotfixVersion && corruptedFiles > 0;
+    if (remotehotfixVersion <= localhotfixVersion && !rollback && !repair) {
 		qDebug() << "No new hotfix version available.";
         emit progressChanged(100, "已是最新版本，无需更新。");
-        emit launchProgramRequested(QString::fromStdString(mainProgram));
+        requestProgramLaunch();
         emit finished(true, "无需更新，即将启动主程序。");
 		return;
 	}
 
+    if (checkOnly) {
+        if (remotehotfixVersion == localhotfixVersion) {
+            emit updateAvailable("repair", QString::number(remotehotfixVersion));
+            emit finished(true, QString("发现 %1 个文件缺失或损坏。").arg(corruptedFiles));
+            return;
+        }
+        emit updateAvailable("hotfix", QString::number(remotehotfixVersion));
+        emit finished(true, "发现热更新。");
+        return;
+    }
+
     // 4. 第三步检查到有热更新，执行热更新
-    qDebug() << "New hotfix version available: "
-        << remotehotfixVersion
-        << " (local: " << localhotfixVersion << ")";
-    emit progressChanged(40, QString("发现热更新 (v%1 -> v%2)，准备下载文件...")
-        .arg(localhotfixVersion)
-        .arg(remotehotfixVersion));
-    if (!downloadAndApplyHotfix()) {
-        emit finished(false, "热更新过程中发生错误。");
+    // 允许回滚时服务器版本号比本地小表示服务器回滚了热更新，本地仓库里有旧版本文件时不需要下载
+    if (rollback) {
+        qDebug() << "Hotfix rolled back on server: "
+            << remotehotfixVersion
+            << " (local: " << localhotfixVersion << ")";
+    }
+    else if (remotehotfixVersion > localhotfixVersion) {
+        qDebug() << "New hotfix version available: "
+            << remotehotfixVersion
+            << " (local: " << localhotfixVersion << ")";
+    }
+    if (remotehotfixVersion == localhotfixVersion) {
+        // 版本相同但校验发现文件损坏，按同一个版本重新提交一次
+        qDebug() << "Repairing corrupted files: " << corruptedFiles;
+        emit progressChanged(40, QString("发现 %1 个文件缺失或损坏，准备修复...").arg(corruptedFiles));
+    }
+    else {
+        emit progressChanged(40, QString("发现热更新 (v%1 -> v%2)，准备下载文件...")
+            .arg(localhotfixVersion)
+            .arg(remotehotfixVersion));
+    }
+    // 主程序已经在运行时文件可能被占用，只把文件准备进仓库，下次启动时提交
+    downloadAndApplyHotfix(localhotfixVersion, launchedEarly, [this](bool hotfixApplied) {
+        localIndex.save();
+        if (!hotfixApplied) {
+            emit finished(false, "热更新过程中发生错误。");
+            return;
+        }
+
+        if (launchedEarly) {
+            writeStagedUpdate("hotfix");
+            emit progressChanged(100, "热更新已在后台下载完成。");
+            emit finished(true, "热更新已下载，下次启动时生效。");
+            return;
+        }
+
+        // 5. 本地hotfix版本号已在提交阶段更新，完成
+        emit progressChanged(100, "热更新应用成功！");
+        requestProgramLaunch();
+        emit finished(true, "更新完成，即将启动主程序。");
+    });
+}
+
+void Updater::verifyHotfixFiles(DoneHandler done) {
+    metrics.beginPhase("verify");
+    QStringList paths;
+    paths.reserve(hotfixFiles.size());
+    for (int i = 0; i < hotfixFiles.size(); ++i) {
+        paths.append(hotfixFiles.filePath(i));
+    }
+    emit progressChanged(30, QString("正在校验 %1 个本地文件...").arg(paths.size()));
+    qDebug() << "Verifying local files: " << paths.size()
+        << " threads: " << QThreadPool::globalInstance()->maxThreadCount();
+
+    // 每个文件一个任务，在全局线程池里并行计算，工作线程的事件循环只负责收结果
+    // 哈希计算不经过索引，也就不会因为大小和修改时间没变而跳过被篡改的文件
+    auto watcher = new QFutureWatcher<QString>(this);
+    auto timer = std::make_shared<QElapsedTimer>();
+    timer->start();
+    const int total = paths.size();
+    connect(watcher, &QFutureWatcher<QString>::progressValueChanged, this, [this, total](int value) {
+        if (total > 0) {
+            emit progressChanged(30 + 10 * value / total, QString("正在校验本地文件 (%1/%2)").arg(value).arg(total));
+        }
+    });
+    connect(watcher, &QFutureWatcher<QString>::finished, this, [this, watcher, paths, timer, done]() {
+        watcher->deleteLater();
+        QFuture<QString> future = watcher->future();
+        if (future.resultCount() != paths.size()) {
+            done(false);
+            return;
+        }
+
+        corruptedFiles = 0;
+        for (int i = 0; i < paths.size(); ++i) {
+            const QString& path = paths[i];
+            QString hash = future.resultAt(i);
+            // 用新算出的哈希覆盖索引，随后的扫描据此决定哪些文件需要修复
+            if (hash.isEmpty()) {
+                localIndex.remove(path);
+            }
+            else {
+                localIndex.update(path, hash);
+            }
+            if (!hotfixFiles.digestMatches(i, hash)) {
+                ++corruptedFiles;
+                qDebug() << "File missing or corrupted: " << path;
+                emit fileCorrupted(path);
+            }
+        }
+        localIndex.save();
+        qDebug() << "Verified local files: " << paths.size() << " corrupted: " << corruptedFiles
+            << " elapsed(ms): " << timer->elapsed();
+        done(true);
+    });
+    watcher->setFuture(QtConcurrent::mapped(paths, &LocalFileIndex::computeHash));
+}
+
+void Updater::requestProgramLaunch() {
+    if (launchedEarly) {
         return;
     }
+    emit launchProgramRequested(QString::fromStdString(mainProgram), false);
+}
+
+bool Updater::launchBeforeCheck() {
+    // 主程序路径来自上次的版本信息，第一次运行没有缓存时按正常流程检查完再启动
+    std::string program = mainProgram;
+    ManifestTable cached;
+    if (program.empty() && readCachedManifest(readManifestCache(manifestCacheFile), cached)) {
+        program = cached.mainProgram;
+    }
+    if (program.empty()) {
+        qDebug() << "Launch-first mode: no cached manifest, checking before launch.";
+        return false;
+    }
 
-    // 5. 更新本地hotfix版本号并完成
-    writeLocalVersion(hotfixVersionFile, to_string(remotehotfixVersion));
-    emit progressChanged(100, "热更新应用成功！");
-    emit launchProgramRequested(QString::fromStdString(mainProgram));
-    emit finished(true, "更新完成，即将启动主程序。");
+    qDebug() << "Launch-first mode: launching before update check: " << QString::fromStdString(program);
+    emit launchProgramRequested(QString::fromStdString(program), true);
+    launchedEarly = true;
+
+    // 之后的检查和下载都在后台进行：降低线程优先级，逐个下载，尽量不影响主程序启动
+    lowerCurrentThreadPriority();
+    config.maxConcurrentDownloads = 1;
+    return true;
 }
 
-bool Updater::getRemoteVersion() {
-    // 获取远程版本信息
-    HTTPRequest request(HTTP_GET, baseUrl + "/api/updater/version");
-    request.SimpleDebug();
-    HTTPResponse response = HTTPClient::getInstance().send(request);
-    response.SimpleDebug();
+void Updater::writeStagedUpdate(const QString& kind) {
+    QJsonObject staged;
+    staged["kind"] = kind;
+    staged["manifest"] = hotfixFiles.toJson();
+    if (!writeStateFile(stagedUpdateFile, staged)) {
+        qDebug() << "Failed to write staged update marker.";
+    }
+}
+
+bool Updater::applyStagedUpdate() {
+    QJsonObject staged = readStateFile(stagedUpdateFile);
+    if (staged.isEmpty()) {
+        return false;
+    }
+    // 标记只用一次，不管这次能否提交，后面的检查都会重新判断
+    QFile::remove(stagedUpdateFile);
+
+    metrics.beginPhase("staged_commit");
+    if (!parseManifest(staged["manifest"].toObject())) {
+        return false;
+    }
 
-    if (response.is_Status_200()) {
-		QJsonObject res_json = response.get_payload_QJsonObject();
+    QString kind = staged["kind"].toString();
+    if (kind == "installer") {
+        QString installerName = installerFileName(remoteInstallerVersion);
+        if (!localIndex.matches(installerName, installerHash)) {
+            qDebug() << "Staged installer is missing or corrupted: " << installerName;
+            return false;
+        }
+        qDebug() << "Launching staged installer: " << installerName;
+        emit launchInstallerRequested(installerName);
+        return true;
+    }
 
-        this->mainProgram = res_json["main_program"].toString().toStdString();
+    int localhotfixVersion = readLocalVersion(hotfixVersionFile);
+    if (kind == "hotfix" && localhotfixVersion != remotehotfixVersion) {
+        bool committed = commitStagedHotfix(localhotfixVersion);
+        qDebug() << "Staged hotfix " << localhotfixVersion << " -> " << remotehotfixVersion
+            << (committed ? " committed." : " could not be committed.");
+        localIndex.save();
+    }
+    return false;
+}
 
-        this->remoteInstallerVersion = res_json["version"].toString().toStdString();
-        this->installerHash = res_json["hash"].toString().toStdString();
+bool Updater::commitStagedHotfix(int fromVersion) {
+    std::vector<FileInfo> changed;
+    std::vector<const FileInfo*> missing;
+    ArtifactStore::Snapshot previous;
+    scanHotfixFiles(changed, missing, previous);
+    if (!missing.empty()) {
+        qDebug() << "Staged hotfix is incomplete, files missing from store: " << missing.size();
+        return false;
+    }
+    return commitHotfix(fromVersion, changed, previous);
+}
 
-        this->remotehotfixVersion = res_json["hotfix"].toString().toInt();
+void Updater::getRemoteVersion(DoneHandler done, int attempt) {
+    // 本地缓存的版本信息
+    QJsonObject cache = readManifestCache(manifestCacheFile);
+    const bool haveCache = hasCachedManifest(cache);
+    qint64 cacheAge = QDateTime::currentMSecsSinceEpoch() - static_cast<qint64>(cache["fetched_at"].toDouble());
 
-        hotfixFileList.clear();
-        for (const auto& file : res_json["files"].toArray()) {
-			FileInfo fileInfo;
-			fileInfo.filename = file.toObject()["filename"].toString().toStdString();
-			fileInfo.hash = file.toObject()["hash"].toString().toStdString();
-			this->hotfixFileList.push_back(fileInfo);
-		}
-		return true;
-	}
-	else {
-		qDebug() << "Failed to get remote version: " << response.status_code;
-		return false;
-	}
+    // 缓存还在有效期内，直接使用，不访问网络
+    if (haveCache && config.manifestMaxAge > 0
+        && cacheAge >= 0 && cacheAge < config.manifestMaxAge * 1000LL) {
+        qDebug() << "Using cached manifest, age(ms): " << cacheAge;
+        metrics.beginPhase("manifest_parse");
+        ManifestTable cached;
+        done(readCachedManifest(cache, cached) && useManifest(std::move(cached)));
+        return;
+    }
+
+    // 确实要访问网络时才探测镜像，缓存有效时不用等探测；探测完再从头走一遍
+    if (!mirrorsProbed && mirrors.size() > 1) {
+        mirrorsProbed = true;
+        metrics.beginPhase("probe");
+        mirrors.probe(config.probeTimeoutMs, [this, done, attempt]() {
+            metrics.beginPhase("manifest");
+            getRemoteVersion(done, attempt);
+        });
+        return;
+    }
+
+    // 获取远程版本信息，有缓存时带上校验信息，服务器确认没变化会返回304
+    // 对冲：第一个请求在最近耗时的百分位内还没有结果时再发一个，先拿到可用响应的生效，另一个中止；
+    // 都失败才算这次失败
+    struct ManifestRace {
+        int outstanding = 0;
+        bool settled = false;
+        std::vector<QPointer<HTTPTransfer>> transfers;
+    };
+    auto race = std::make_shared<ManifestRace>();
+    auto send = [this, race, done, attempt, cache, haveCache](const QString& mirror) {
+        HTTPRequest request(HTTP_GET, mirror + "/api/updater/version");
+        if (config.binaryManifest) {
+            request.add_header("Accept", "application/cbor, application/json;q=0.9");
+        }
+        if (haveCache) {
+            if (!cache["etag"].toString().isEmpty()) {
+                request.add_header("If-None-Match", cache["etag"].toString());
+            }
+            if (!cache["last_modified"].toString().isEmpty()) {
+                request.add_header("If-Modified-Since", cache["last_modified"].toString());
+            }
+        }
+        request.SimpleDebug();
+        ++race->outstanding;
+        race->transfers.push_back(HTTPClient::getInstance().sendAsync(request,
+            [this, race, done, attempt, mirror, cache, haveCache, url = request.url](HTTPResponse& response) {
+            --race->outstanding;
+            response.SimpleDebug();
+            metrics.recordRequest(url, response);
+            if (race->settled) {
+                // 另一个请求已经先有了结果，这个是被中止的
+                return;
+            }
+
+            bool notModified = response.status_code == 304 && haveCache;
+            if (!notModified && !response.is_Status_200() && race->outstanding > 0) {
+                qDebug() << "Manifest request failed, waiting for the hedged one: " << response.status_code;
+                return;
+            }
+            race->settled = true;
+            for (const auto& transfer : race->transfers) {
+                if (transfer) {
+                    transfer->abort();
+                }
+            }
+            const QJsonArray latencies = appendLatency(cache["latencies"].toArray(), response.elapsed_ms);
+
+            if (notModified) {
+                qDebug() << "Manifest not modified, using cache.";
+                QJsonObject refreshed = cache;
+                refreshed["fetched_at"] = static_cast<double>(QDateTime::currentMSecsSinceEpoch());
+                refreshed["latencies"] = latencies;
+                writeManifestCache(manifestCacheFile, refreshed);
+                metrics.beginPhase("manifest_parse");
+                ManifestTable cached;
+                done(readCachedManifest(cache, cached) && useManifest(std::move(cached)));
+            }
+            else if (response.is_Status_200()) {
+                metrics.beginPhase("manifest_parse");
+                QJsonObject updated;
+                if (response.get_header("Content-Type").startsWith("application/cbor", Qt::CaseInsensitive)) {
+                    if (!parseManifest(response.payload)) {
+                        done(false);
+                        return;
+                    }
+                    updated["body_cbor"] = QString::fromLatin1(response.payload.toBase64());
+                }
+                else {
+                    QJsonObject res_json = response.get_payload_QJsonObject();
+                    if (!parseManifest(res_json)) {
+                        done(false);
+                        return;
+                    }
+                    updated["body"] = res_json;
+                }
+
+                updated["etag"] = response.get_header("ETag");
+                updated["last_modified"] = response.get_header("Last-Modified");
+                updated["fetched_at"] = static_cast<double>(QDateTime::currentMSecsSinceEpoch());
+                updated["latencies"] = latencies;
+                writeManifestCache(manifestCacheFile, updated);
+                done(true);
+            }
+            else {
+                qDebug() << "Failed to get remote version: " << response.status_code;
+                if (attempt + 1 < mirrors.size() && mirrors.reportFailure(mirror, "manifest")) {
+                    getRemoteVersion(done, attempt + 1);
+                    return;
+                }
+                done(false);
+            }
+        }));
+    };
+
+    send(mirrors.current());
+    // 换镜像重试时不再对冲，失败的那个镜像已经排到后面了
+    if (config.manifestHedge && attempt == 0) {
+        int delayMs = hedgeDelayMs(cache["latencies"].toArray(), config.hedgePercentile);
+        QTimer::singleShot(delayMs, this, [this, race, send, delayMs]() {
+            if (race->settled || race->outstanding == 0) {
+                return;
+            }
+            qDebug() << "Manifest request slower than " << delayMs << " ms, sending a hedged request.";
+            send(mirrors.alternate());
+        });
+    }
+}
+
+bool Updater::parseManifest(const QJsonObject& res_json) {
+    ManifestTable manifest;
+    QString error;
+    if (!manifest.fromJson(res_json, &error)) {
+        qDebug() << "Invalid manifest: " << error;
+        return false;
+    }
+    return useManifest(std::move(manifest));
+}
+
+bool Updater::parseManifest(const QByteArray& cbor) {
+    ManifestTable manifest;
+    QString error;
+    if (!manifest.fromCbor(cbor, &error)) {
+        qDebug() << "Invalid binary manifest: " << error;
+        return false;
+    }
+    return useManifest(std::move(manifest));
 }
 
-bool Updater::downloadAndPrepareInstaller(const QString& installerName) {
-    QString url = baseUrl + "/updater/" + installerName;
+bool Updater::useManifest(ManifestTable&& manifest) {
+    this->mainProgram = manifest.mainProgram;
+
+    this->remoteInstallerVersion = manifest.version;
+    this->installerHash = manifest.hash;
+
+    this->remotehotfixVersion = manifest.hotfix;
+    this->hotfixBundle = manifest.bundle;
+
+    this->hotfixFiles = std::move(manifest);
+    qDebug() << "Manifest files: " << hotfixFiles.size();
+    return true;
+}
 
+void Updater::downloadAndPrepareInstaller(const QString& installerName, DoneHandler done) {
     emit progressChanged(50, "正在下载安装包: " + installerName);
 
     FileInfo installerInfo;
     installerInfo.filename = installerName.toStdString();
     installerInfo.hash = installerHash;
 
-    return downloadFile(installerInfo, url, installerName);
+    // 单个大文件按字节报告进度，映射到 50~95，百分比变化时才通知UI
+    auto lastPercent = std::make_shared<int>(-1);
+    auto onProgress = [this, lastPercent, installerName](qint64 received, qint64 total, double rate) {
+        if (total <= 0) {
+            return;
+        }
+        // 压缩传输时 total 是压缩后的大小，而 received 按解压后的字节计，这里夹一下
+        int percent = qBound(0, static_cast<int>(100 * received / total), 100);
+        if (percent != *lastPercent) {
+            *lastPercent = percent;
+            QString text = QString("正在下载安装包: %1 (%2%)").arg(installerName).arg(percent);
+            if (rate > 0 && received < total) {
+                text += QString("，%1 KB/s，%2")
+                    .arg(static_cast<qint64>(rate / 1024))
+                    .arg(formatEta(static_cast<qint64>((total - received) / rate)));
+            }
+            emit progressChanged(50 + 45 * percent / 100, text);
+        }
+    };
+    // 单连接下载时换镜像续传会发出新的请求，每个请求都接上进度
+    auto onTransfer = [this, onProgress](HTTPTransfer* transfer) {
+        auto clock = std::make_shared<QElapsedTimer>();
+        clock->start();
+        connect(transfer, &HTTPTransfer::progress, this, [onProgress, clock](qint64 received, qint64 total) {
+            onProgress(received, total, effectiveRate(received, clock->elapsed()));
+        });
+    };
+
+    // 先下载到 .tmp，校验通过后再改名，避免留下不完整的安装包
+    // 大安装包分段并发下载，分段进度按所有段的合计报告
+    downloadSegmented(installerInfo, "/updater/" + installerName, installerName + ".tmp",
+        [this, installerInfo, installerName, done](bool ok) {
+            metrics.beginPhase("apply");
+            if (!ok || !applyUpdate(installerInfo)) {
+                done(false);
+                return;
+            }
+            localIndex.update(installerName, QString::fromStdString(installerHash));
+            done(true);
+        },
+        onTransfer, onProgress);
 }
 
-bool Updater::downloadAndApplyHotfix() {
-    if (hotfixFileList.empty()) {
-        qDebug() << "Hotfix file list is empty, nothing to do.";
+void Updater::scanHotfixFiles(std::vector<FileInfo>& changed, std::vector<const FileInfo*>& missing,
+    ArtifactStore::Snapshot& previous) {
+    // 本地文件已经是目标版本的，跳过
+    // 其余文件中，本地仓库里已有的（回滚、曾经下载过）和本批中内容相同的只需下载一次
+    std::vector<int> changedIndexes;
+    for (int i = 0; i < hotfixFiles.size(); ++i) {
+        QString localPath = hotfixFiles.filePath(i);
+        QString localHash = localIndex.hashOf(localPath);
+        if (!localHash.isEmpty()) {
+            previous[localPath.toStdString()] = localHash.toStdString();
+        }
+        if (hotfixFiles.digestMatches(i, localHash)) {
+            qDebug() << "File unchanged, skipped: " << localPath;
+            continue;
+        }
+        changedIndexes.push_back(i);
+    }
+
+    // 先把 changed 的容量定下来，missing 里的指针才不会失效
+    changed.reserve(changed.size() + changedIndexes.size());
+    std::set<std::string> missingHashes;
+    for (int i : changedIndexes) {
+        changed.push_back(hotfixFiles.fileInfo(i));
+        const FileInfo& file = changed.back();
+
+        // 仓库对象和安装目录里的文件是硬链接，校验模式下要修复的文件可能连仓库对象一起被改坏了，
+        // 重新计算哈希，坏掉的对象丢弃后重新下载
+        if (verify ? artifactStore.verifyObject(file.hash) : artifactStore.contains(file.hash)) {
+            qDebug() << "File found in local store: " << QString::fromStdString(file.filename);
+            continue;
+        }
+        if (missingHashes.insert(file.hash).second) {
+            missing.push_back(&file);
+        }
+    }
+}
+
+void Updater::downloadAndApplyHotfix(int fromVersion, bool stageOnly, DoneHandler done) {
+    metrics.beginPhase("scan");
+    auto pendingFiles = std::make_shared<std::vector<FileInfo>>();
+    auto previous = std::make_shared<ArtifactStore::Snapshot>();
+    std::vector<const FileInfo*> downloadFiles;
+    scanHotfixFiles(*pendingFiles, downloadFiles, *previous);
+
+    // 所有文件都已下载校验并放进仓库后，才进入短暂的提交阶段
+    // 只准备不提交时到这里就结束，安装目录保持不变
+    auto commit = [this, pendingFiles, previous, fromVersion, stageOnly, done]() {
+        if (stageOnly) {
+            done(true);
+            return;
+        }
+        metrics.beginPhase("commit");
+        emit progressChanged(95, "正在应用更新...");
+        done(commitHotfix(fromVersion, *pendingFiles, *previous));
+    };
+
+    if (downloadFiles.empty()) {
+        qDebug() << "All changed files are available locally, no download needed.";
+        commit();
+        return;
+    }
+
+    // 下载，全部校验通过后移入仓库
+    // 打包下载已经解进仓库的文件不再单独下载
+    auto downloaded = std::make_shared<std::vector<const FileInfo*>>(downloadFiles);
+    metrics.beginPhase("download");
+    auto downloadRemaining = [this, downloaded, commit, done]() {
+        auto remaining = std::make_shared<std::vector<const FileInfo*>>();
+        for (const FileInfo* file : *downloaded) {
+            if (!artifactStore.contains(file->hash)) {
+                remaining->push_back(file);
+            }
+        }
+        if (remaining->empty()) {
+            commit();
+            return;
+        }
+        downloadFilesConcurrently(*remaining, [this, remaining, commit, done](bool ok) {
+            if (!ok) {
+                done(false);
+                return;
+            }
+            metrics.beginPhase("store");
+            for (const FileInfo* file : *remaining) {
+                if (!artifactStore.moveIn(QString::fromStdString(file->filename) + ".tmp", file->hash)) {
+                    done(false);
+                    return;
+                }
+            }
+            commit();
+        });
+    };
+
+    // 需要完整下载的文件（没有可用的差分补丁）占了这个版本的大部分时，整包下载比逐个请求划算
+    std::vector<const FileInfo*> bundleFiles;
+    for (const FileInfo* file : downloadFiles) {
+        if (usablePatchBase(*file).isEmpty()) {
+            bundleFiles.push_back(file);
+        }
+    }
+    bool useBundle = config.useBundles && !hotfixBundle.empty()
+        && bundleFiles.size() >= 2 && bundleFiles.size() * 2 >= static_cast<size_t>(hotfixFiles.distinctDigests());
+    if (!useBundle) {
+        downloadRemaining();
+        return;
+    }
+
+    // 打包下载失败（服务器没有发布、传输中断、条目校验失败）时，剩下的文件退回逐个下载
+    downloadBundle(bundleFiles, [downloadRemaining](bool) {
+        downloadRemaining();
+    });
+}
+
+bool Updater::commitHotfix(int fromVersion, const std::vector<FileInfo>& files,
+    const ArtifactStore::Snapshot& previous) {
+    // 被替换的旧文件先链接进仓库，保证提交中途失败时可以回滚
+    for (const FileInfo& file : files) {
+        auto old = previous.find(file.filename);
+        if (old != previous.end()) {
+            artifactStore.linkIn(QString::fromStdString(file.filename), old->second);
+        }
+    }
+
+    // 写提交日志，之后安装目录进入不一致窗口，直到日志被删除
+    QJsonArray journalFiles;
+    for (const FileInfo& file : files) {
+        auto old = previous.find(file.filename);
+        QJsonObject entry;
+        entry["filename"] = QString::fromStdString(file.filename);
+        entry["hash"] = QString::fromStdString(file.hash);
+        entry["old_hash"] = old != previous.end() ? QString::fromStdString(old->second) : QString();
+        journalFiles.append(entry);
+    }
+    QJsonObject previousFiles;
+    for (const auto& file : previous) {
+        previousFiles[QString::fromStdString(file.first)] = QString::fromStdString(file.second);
+    }
+    QJsonObject currentFiles;
+    for (int i = 0; i < hotfixFiles.size(); ++i) {
+        currentFiles[hotfixFiles.filePath(i)] = QString::fromStdString(hotfixFiles.hexDigest(i));
+    }
+    QJsonObject journal;
+    journal["from_version"] = fromVersion;
+    journal["to_version"] = remotehotfixVersion;
+    journal["files"] = journalFiles;
+    journal["previous"] = previousFiles;
+    journal["current"] = currentFiles;
+    if (!writeStateFile(commitJournalFile, journal)) {
+        qDebug() << "Failed to write commit journal.";
+        return false;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    if (!replayCommitJournal(journal, true)) {
+        // 前滚失败（比如文件被占用），按日志回滚到更新前的状态
+        qDebug() << "Commit failed, rolling back.";
+        replayCommitJournal(journal, false);
+        return false;
+    }
+    qDebug() << "Hotfix committed, files: " << files.size() << " elapsed(ms): " << timer.elapsed();
+    return true;
+}
+
+bool Updater::replayCommitJournal(const QJsonObject& journal, bool forward) {
+    bool ok = true;
+    for (const auto& item : journal["files"].toArray()) {
+        QJsonObject entry = item.toObject();
+        QString localPath = entry["filename"].toString();
+        std::string hash = entry[forward ? "hash" : "old_hash"].toString().toStdString();
+
+        if (hash.empty()) {
+            // 回滚一个更新前不存在的文件
+            QFile::remove(localPath);
+            localIndex.remove(localPath);
+            continue;
+        }
+        // place 是一次 rename，重复执行也没有问题
+        if (!artifactStore.place(hash, localPath)) {
+            ok = false;
+            if (forward) {
+                return false;
+            }
+            continue;
+        }
+        localIndex.update(localPath, QString::fromStdString(hash));
+    }
+
+    int version = journal[forward ? "to_version" : "from_version"].toInt();
+    writeLocalVersion(hotfixVersionFile, to_string(version));
+
+    // 记录版本快照，最后记录的是当前版本
+    auto toSnapshot = [](const QJsonObject& files) {
+        ArtifactStore::Snapshot snapshot;
+        for (auto it = files.begin(); it != files.end(); ++it) {
+            snapshot[it.key().toStdString()] = it.value().toString().toStdString();
+        }
+        return snapshot;
+    };
+    if (forward) {
+        artifactStore.recordVersions({
+            { journal["from_version"].toInt(), toSnapshot(journal["previous"].toObject()) },
+            { version, toSnapshot(journal["current"].toObject()) } });
+    }
+    localIndex.save();
+
+    // 安装目录已经一致，删除日志
+    QFile::remove(commitJournalFile);
+    return ok;
+}
+
+void Updater::recoverInterruptedCommit() {
+    QJsonObject journal = readStateFile(commitJournalFile);
+    if (journal.isEmpty()) {
+        return;
+    }
+
+    // 新版本的文件都还在仓库里就前滚完成提交，否则回滚到更新前
+    // 校验模式下同样不直接信任仓库对象
+    bool canRollForward = true;
+    for (const auto& item : journal["files"].toArray()) {
+        std::string hash = item.toObject()["hash"].toString().toStdString();
+        if (!(verify ? artifactStore.verifyObject(hash) : artifactStore.contains(hash))) {
+            canRollForward = false;
+            break;
+        }
+    }
+    qDebug() << "Found interrupted hotfix commit "
+        << journal["from_version"].toInt() << " -> " << journal["to_version"].toInt()
+        << (canRollForward ? ", rolling forward." : ", rolling back.");
+    replayCommitJournal(journal, canRollForward);
+}
+
+// --- Download Helpers ---
+// 一个文件下载的落地端：边收边写 .tmp 文件，同时增量计算哈希
+// 下载中断时保留 .tmp，并在旁边的 .tmp.meta 里记下期望哈希和服务器的 ETag/Last-Modified，
+// 下次下载同一文件时用 Range/If-Range 从断点续传
+class DownloadSink {
+public:
+    DownloadSink(const QString& savePath, const FileInfo& file, const QString& mirror)
+        : outFile(savePath), file(file), mirror(mirror), hasher(QCryptographicHash::Md5) {
+        fileStats.filename = QString::fromStdString(file.filename);
+        fileStats.source = "download";
+        clock.start();
+    }
+
+    // 打开 .tmp 文件，有可续传的部分内容时保留并重新计算已有部分的哈希
+    bool open() {
+        QJsonObject meta = readMeta();
+        bool resumable = meta["hash"].toString() == QString::fromStdString(file.hash)
+            && outFile.exists() && outFile.size() > 0;
+
+        if (!resumable) {
+            QFile::remove(metaPath());
+            if (!outFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+                qDebug() << "Failed to open file for writing: " << outFile.fileName();
+                return false;
+            }
+            return true;
+        }
+
+        if (!outFile.open(QIODevice::ReadWrite)) {
+            qDebug() << "Failed to open file for writing: " << outFile.fileName();
+            return false;
+        }
+        // 哈希状态没有持久化，续传前把已有部分重新过一遍
+        qint64 hashStart = clock.nsecsElapsed();
+        bool rehashed = hasher.addData(&outFile);
+        fileStats.hashNs += clock.nsecsElapsed() - hashStart;
+        if (!rehashed) {
+            qDebug() << "Failed to read partial file: " << outFile.fileName();
+            outFile.close();
+            discard();
+            return open();
+        }
+        resumeOffset = outFile.pos();
+        // ETag/Last-Modified 只对记录它的那个服务器有意义，换了镜像续传时只靠最后的哈希校验
+        if (meta["mirror"].toString() == mirror) {
+            validator = meta["etag"].toString();
+            if (validator.isEmpty()) {
+                validator = meta["last_modified"].toString();
+            }
+        }
+
+        // 上次其实已经下完了，只是没来得及改名
+        if (hasher.result().toHex() == QString::fromStdString(file.hash)) {
+            qDebug() << "Partial file is already complete: " << outFile.fileName();
+            outFile.close();
+            QFile::remove(metaPath());
+            complete = true;
+            return true;
+        }
+
+        qDebug() << "Resuming download: " << outFile.fileName() << " from byte " << resumeOffset;
+        return true;
+    }
+
+    // .tmp 里已经是完整且校验通过的文件，不需要再下载
+    bool isComplete() const {
+        return complete;
+    }
+
+    // 续传时追加 Range/If-Range 请求头
+    void prepareRequest(HTTPRequest& request) const {
+        if (resumeOffset <= 0) {
+            return;
+        }
+        request.add_header("Range", QString("bytes=%1-").arg(resumeOffset));
+        if (!validator.isEmpty()) {
+            // 服务器上的文件变了时，服务器会忽略 Range 返回完整的200
+            request.add_header("If-Range", validator);
+        }
+        // Range 针对的是原始字节，续传时不能让服务器压缩
+        request.accept_compressed = false;
+    }
+
+    // 收到响应头，确认是续传(206)还是从头开始(200)
+    bool begin(const HTTPResponse& head) {
+        if (head.status_code == 206) {
+            // Content-Range: bytes <start>-<end>/<total>
+            QString contentRange = head.get_header("Content-Range");
+            qint64 start = contentRange.section(' ', 1).section('-', 0, 0).toLongLong();
+            if (resumeOffset <= 0 || start != resumeOffset) {
+                qDebug() << "Unexpected Content-Range: " << contentRange << " expected start: " << resumeOffset;
+                return false;
+            }
+        }
+        else if (resumeOffset > 0) {
+            // 服务器不支持 Range 或文件已变化，丢弃已有部分从头开始
+            qDebug() << "Server ignored range request, restarting download: " << outFile.fileName();
+            outFile.resize(0);
+            outFile.seek(0);
+            hasher.reset();
+            resumeOffset = 0;
+        }
+        fileStats.source = resumeOffset > 0 ? "resume" : "download";
+
+        // 记下续传需要的信息，下载中途被打断时下次可以接着下
+        QJsonObject meta;
+        meta["hash"] = QString::fromStdString(file.hash);
+        meta["etag"] = head.get_header("ETag");
+        meta["last_modified"] = head.get_header("Last-Modified");
+        meta["mirror"] = mirror;
+        QFile metaFile(metaPath());
+        if (metaFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            metaFile.write(QJsonDocument(meta).toJson(QJsonDocument::Compact));
+        }
+        return true;
+    }
+
+    bool write(const char* data, qint64 size) {
+        qint64 hashStart = clock.nsecsElapsed();
+        hasher.addData(data, static_cast<int>(size));
+        qint64 writeStart = clock.nsecsElapsed();
+        qint64 written = outFile.write(data, size);
+        fileStats.hashNs += writeStart - hashStart;
+        fileStats.writeNs += clock.nsecsElapsed() - writeStart;
+        if (written != size) {
+            writeFailed = true;
+            return false;
+        }
+        fileStats.bytesWritten += size;
         return true;
     }
 
-    int totalFiles = hotfixFileList.size();
-    for (int i = 0; i < totalFiles; ++i) {
-        const auto& file = hotfixFileList[i];
-        int progress = 40 + static_cast<int>((static_cast<double>(i) / totalFiles) * 60.0);
+    // 失败原因在本地（写盘出错），换镜像也没用
+    bool failedLocally() const {
+        return writeFailed;
+    }
+
+    // 本次下载的统计，传输字节数和总耗时由调用方从响应中补上
+    const UpdateMetrics::FileStats& stats() const {
+        return fileStats;
+    }
+
+    // 下载结束后关闭文件并检查结果
+    // 网络中断、连接失败、5xx/429 时保留已下载的部分用于续传，
+    // 只有写盘失败、哈希不对、服务器明确拒绝（4xx，包括416）时删除 .tmp 文件
+    bool finish(const HTTPResponse& response) {
+        outFile.close();
+
+        if (writeFailed) {
+            qDebug() << "Failed to write file: " << outFile.fileName() << outFile.errorString();
+            discard();
+            return false;
+        }
 
-        // 下载
-        emit progressChanged(progress, QString("正在下载文件: %1 (%2/%3)...")
-            .arg(QString::fromStdString(file.filename))
-            .arg(i + 1)
-            .arg(totalFiles));
-        QString url = baseUrl + "/updater/" + QString::fromStdString(file.filename);
-        QString tempPath = QString::fromStdString(file.filename) + ".tmp";
-        if (!downloadFile(file, url, tempPath)) {
+        bool statusOk = response.status_code == 200 || response.status_code == 206;
+        if (!statusOk || response.error_code != QNetworkReply::NetworkError::NoError) {
+            qDebug() << "Failed to download file: " << QString::fromStdString(file.filename)
+                << response.status_code << " " << response.reason_phrase << " " << response.error_string;
+            // 非2xx的响应不会写入数据，上次留下的 .tmp 和 .meta 原样保留，下次还能续传
+            bool rejected = response.status_code >= 400 && response.status_code < 500 && response.status_code != 429;
+            bool keep = statusOk ? outFile.size() > 0 && QFile::exists(metaPath()) : !rejected;
+            if (keep) {
+                qDebug() << "Keeping partial file for resume: " << outFile.fileName() << outFile.size();
+            }
+            else {
+                discard();
+            }
             return false;
         }
 
-        // 应用
-        emit progressChanged(progress, QString("正在应用更新: %1...")
-            .arg(QString::fromStdString(file.filename)));
-        if (!applyUpdate(file)) {
+        // 传输结束时哈希已经算完，直接比较
+        QString temp_hash = hasher.result().toHex();
+        if (temp_hash != QString::fromStdString(file.hash)) {
+            qDebug() << "Hash mismatch for file: " << QString::fromStdString(file.filename)
+                << "Expected: " << QString::fromStdString(file.hash)
+                << "Got: " << temp_hash;
+            discard();
             return false;
         }
+
+        QFile::remove(metaPath());
+        qDebug() << "Downloaded and verified: " << QString::fromStdString(file.filename);
+        return true;
     }
-    return true;
-}
 
-bool Updater::downloadFile(const FileInfo& file, const QString& url, const QString& savePath) {
+private:
+    QString metaPath() const {
+        return outFile.fileName() + ".meta";
+    }
+
+    QJsonObject readMeta() const {
+        QFile metaFile(metaPath());
+        if (!metaFile.open(QIODevice::ReadOnly)) {
+            return QJsonObject();
+        }
+        return QJsonDocument::fromJson(metaFile.readAll()).object();
+    }
+
+    void discard() {
+        outFile.remove();
+        QFile::remove(metaPath());
+        hasher.reset();
+        resumeOffset = 0;
+    }
+
+    QFile outFile;
+    FileInfo file;
+    QString mirror;
+    QCryptographicHash hasher;
+    qint64 resumeOffset = 0;
+    QString validator;
+    bool complete = false;
+    bool writeFailed = false;
+
+    QElapsedTimer clock;
+    UpdateMetrics::FileStats fileStats;
+};
+
+// 分段下载的落地端：.tmp 预先扩到完整大小，每段把数据写进自己的区间
+// 完成的段记在旁边的 .tmp.segments 里，中断后只需要重新下载没完成的段
+// 各段的数据不是按顺序到达的，哈希只能在全部完成后整体计算
+class SegmentedSink {
+public:
+    struct Segment {
+        qint64 start = 0;
+        qint64 end = 0;     // 不含
+        qint64 next = 0;    // 下一个要写入的位置
+        bool done = false;
+        int failures = 0;
+    };
+
+    SegmentedSink(const QString& savePath, const FileInfo& file, qint64 size, const QString& validator)
+        : outFile(savePath), file(file), size(size), validator(validator) {
+        fileStats.filename = QString::fromStdString(file.filename);
+        fileStats.source = "segmented";
+        clock.start();
+    }
+
+    // 打开 .tmp：和上次是同一个文件（哈希、大小、服务器校验信息都一致）时沿用已完成的段，
+    // 否则重新分配空间并切成 count 段
+    bool open(int count) {
+        QJsonObject state = readState();
+        bool resumable = state["hash"].toString() == QString::fromStdString(file.hash)
+            && static_cast<qint64>(state["size"].toDouble()) == size
+            && state["validator"].toString() == validator
+            && !state["segments"].toArray().isEmpty()
+            && outFile.exists() && outFile.size() == size;
+
+        // 各段交替写入不同位置，不经过 QFile 的写缓冲
+        if (!outFile.open(QIODevice::ReadWrite | QIODevice::Unbuffered)) {
+            qDebug() << "Failed to open file for writing: " << outFile.fileName();
+            return false;
+        }
+        if (resumable) {
+            for (const auto& value : state["segments"].toArray()) {
+                QJsonArray range = value.toArray();
+                Segment segment;
+                segment.start = static_cast<qint64>(range[0].toDouble());
+                segment.end = static_cast<qint64>(range[1].toDouble());
+                segment.done = range[2].toBool();
+                segment.next = segment.done ? segment.end : segment.start;
+                segments.push_back(segment);
+            }
+            qDebug() << "Resuming segmented download: " << outFile.fileName()
+                << received() << " of " << size << " bytes already done";
+            return true;
+        }
+
+        if (!outFile.resize(size)) {
+            qDebug() << "Failed to preallocate file: " << outFile.fileName() << outFile.errorString();
+            outFile.close();
+            return false;
+        }
+        qint64 length = (size + count - 1) / count;
+        for (qint64 start = 0; start < size; start += length) {
+            Segment segment;
+            segment.start = start;
+            segment.end = qMin(size, start + length);
+            segment.next = start;
+            segments.push_back(segment);
+        }
+        saveState();
+        return true;
+    }
+
+    int count() const {
+        return static_cast<int>(segments.size());
+    }
+
+    Segment& segment(int index) {
+        return segments[index];
+    }
+
+    qint64 totalSize() const {
+        return size;
+    }
+
+    // 所有段已经写入的字节数
+    qint64 received() const {
+        qint64 total = 0;
+        for (const Segment& segment : segments) {
+            total += segment.next - segment.start;
+        }
+        return total;
+    }
+
+    bool allDone() const {
+        return std::all_of(segments.begin(), segments.end(), [](const Segment& segment) {
+            return segment.done;
+        });
+    }
+
+    // 写入分段 index 的下一块数据，超出该段范围时返回false
+    bool write(int index, const char* data, qint64 length) {
+        Segment& segment = segments[index];
+        if (segment.next + length > segment.end) {
+            qDebug() << "Segment overflow: " << outFile.fileName() << segment.start << "-" << segment.end;
+            return false;
+        }
+        qint64 writeStart = clock.nsecsElapsed();
+        bool written = outFile.seek(segment.next) && outFile.write(data, length) == length;
+        fileStats.writeNs += clock.nsecsElapsed() - writeStart;
+        if (!written) {
+            writeFailed = true;
+            return false;
+        }
+        segment.next += length;
+        fileStats.bytesWritten += length;
+        return true;
+    }
+
+    // 分段写满后调用，记进状态文件
+    void markDone(int index) {
+        segments[index].done = true;
+        saveState();
+    }
+
+    // 失败原因在本地（写盘出错），重试也没用
+    bool failedLocally() const {
+        return writeFailed;
+    }
+
+    const UpdateMetrics::FileStats& stats() const {
+        return fileStats;
+    }
+
+    // 全部段完成后整体校验哈希，不一致时删除 .tmp
+    bool verify() {
+        outFile.close();
+        qint64 hashStart = clock.nsecsElapsed();
+        QString hash = LocalFileIndex::computeHash(outFile.fileName());
+        fileStats.hashNs += clock.nsecsElapsed() - hashStart;
+        if (hash != QString::fromStdString(file.hash)) {
+            qDebug() << "Hash mismatch for file: " << QString::fromStdString(file.filename)
+                << "Expected: " << QString::fromStdString(file.hash)
+                << "Got: " << hash;
+            discard();
+            return false;
+        }
+        QFile::remove(statePath());
+        qDebug() << "Downloaded and verified: " << QString::fromStdString(file.filename);
+        return true;
+    }
+
+    // 下载中止时关闭文件，已完成的段留给下次续传
+    void close() {
+        outFile.close();
+    }
+
+    void discard() {
+        outFile.close();
+        outFile.remove();
+        QFile::remove(statePath());
+    }
+
+    static QString statePath(const QString& savePath) {
+        return savePath + ".segments";
+    }
+
+private:
+    QString statePath() const {
+        return statePath(outFile.fileName());
+    }
+
+    QJsonObject readState() const {
+        QFile stateFile(statePath());
+        if (!stateFile.open(QIODevice::ReadOnly)) {
+            return QJsonObject();
+        }
+        return QJsonDocument::fromJson(stateFile.readAll()).object();
+    }
+
+    void saveState() const {
+        QJsonArray ranges;
+        for (const Segment& segment : segments) {
+            ranges.append(QJsonArray{ static_cast<double>(segment.start), static_cast<double>(segment.end), segment.done });
+        }
+        QJsonObject state;
+        state["hash"] = QString::fromStdString(file.hash);
+        state["size"] = static_cast<double>(size);
+        state["validator"] = validator;
+        state["segments"] = ranges;
+        QSaveFile stateFile(statePath());
+        if (stateFile.open(QIODevice::WriteOnly)) {
+            stateFile.write(QJsonDocument(state).toJson(QJsonDocument::Compact));
+            stateFile.commit();
+        }
+    }
+
+    QFile outFile;
+    FileInfo file;
+    qint64 size;
+    QString validator;
+    std::vector<Segment> segments;
+    bool writeFailed = false;
+
+    QElapsedTimer clock;
+    UpdateMetrics::FileStats fileStats;
+};
+
+// 镜像速度检测的周期
+static const int THROUGHPUT_CHECK_MS = 3000;
+
+static HTTPRequest makeDownloadRequest(const QString& url) {
     HTTPRequest request(HTTP_GET, url);
     request.set_headers({
         {"Authorization", "Basic YmpmdTpiamZ1"}
         });
+    return request;
+}
+// --- End Download Helpers ---
+
+void Updater::downloadBundle(const std::vector<const FileInfo*>& files, DoneHandler done) {
+    // 按哈希查找需要的文件，包里其他条目跳过
+    auto wanted = std::make_shared<std::map<std::string, const FileInfo*>>();
+    for (const FileInfo* file : files) {
+        wanted->emplace(file->hash, file);
+    }
+    const int totalFiles = wanted->size();
+
+    // 当前正在解出的条目
+    struct Extraction {
+        std::unique_ptr<QFile> out;
+        const FileInfo* file = nullptr;
+        int extracted = 0;
+        QElapsedTimer clock;
+        qint64 entryStartMs = 0;
+        UpdateMetrics::FileStats stats;
+    };
+    auto state = std::make_shared<Extraction>();
+    state->clock.start();
+
+    auto reader = std::make_shared<HotfixBundleReader>(
+        [this, wanted, state](const HotfixBundleReader::Entry& entry) {
+            auto it = wanted->find(entry.hash.toStdString());
+            if (it == wanted->end() || artifactStore.contains(it->first)) {
+                return false;
+            }
+            // 和逐个下载一样先写 .tmp，校验通过后移入仓库
+            state->file = it->second;
+            QString tempPath = QString::fromStdString(state->file->filename) + ".tmp";
+            QFile::remove(tempPath + ".meta");
+            state->out = std::make_unique<QFile>(tempPath);
+            if (!state->out->open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+                // 跳过，之后单独下载
+                qDebug() << "Failed to open file for writing: " << tempPath;
+                state->out.reset();
+                return false;
+            }
+            state->stats = UpdateMetrics::FileStats();
+            state->stats.filename = QString::fromStdString(state->file->filename);
+            state->stats.source = "bundle";
+            state->entryStartMs = state->clock.elapsed();
+            return true;
+        },
+        [state](const char* data, qint64 size) {
+            qint64 writeStart = state->clock.nsecsElapsed();
+            bool written = state->out->write(data, size) == size;
+            state->stats.writeNs += state->clock.nsecsElapsed() - writeStart;
+            state->stats.bytesWritten += written ? size : 0;
+            return written;
+        },
+        [this, state, totalFiles](const HotfixBundleReader::Entry& entry) {
+            state->out->close();
+            bool stored = artifactStore.moveIn(state->out->fileName(), state->file->hash);
+            state->out.reset();
+
+            state->stats.ok = stored;
+            state->stats.bytesTransferred = static_cast<qint64>(entry.size);
+            state->stats.elapsedMs = state->clock.elapsed() - state->entryStartMs;
+            metrics.recordFile(state->stats);
+            if (!stored) {
+                return false;
+            }
+
+            ++state->extracted;
+            emit progressChanged(40 + 55 * state->extracted / totalFiles,
+                QString("已下载文件: %1 (%2/%3)")
+                .arg(QString::fromStdString(state->file->filename))
+                .arg(state->extracted)
+                .arg(totalFiles));
+            return true;
+        });
+
+    QString url = mirrors.url("/updater/" + QString::fromStdString(hotfixBundle));
+    HTTPRequest request = makeDownloadRequest(url);
     request.SimpleDebug();
-    HTTPResponse response = HTTPClient::getInstance().send(request);
-    response.SimpleDebug();
+    qDebug() << "Downloading hotfix bundle for " << totalFiles << " files: " << url;
+    emit progressChanged(40, QString("正在下载 %1 个文件...").arg(totalFiles));
 
-    if (!response.is_Status_200()) {
-        qDebug() << "Failed to download file: " << QString::fromStdString(file.filename)
-            << response.status_code << " " << response.reason_phrase;
-        return false;
+    HTTPClient::getInstance().downloadAsync(request,
+        [reader](const char* data, qint64 size) {
+            return reader->feed(data, size);
+        },
+        [this, url, reader, state, done](HTTPResponse& response) {
+            response.SimpleDebug();
+            metrics.recordRequest(url, response);
+
+            bool ok = response.is_Status_200()
+                && response.error_code == QNetworkReply::NetworkError::NoError
+                && reader->finish();
+            if (state->out) {
+                // 中断时正在解出的条目不完整
+                state->out->close();
+                state->out->remove();
+                state->out.reset();
+            }
+            if (ok) {
+                qDebug() << "Hotfix bundle extracted, files: " << state->extracted;
+            }
+            else {
+                qDebug() << "Hotfix bundle unusable, extracted " << state->extracted
+                    << " files, falling back to per-file downloads: "
+                    << response.status_code << reader->errorString();
+            }
+            done(ok);
+        });
+}
+
+void Updater::downloadFile(const FileInfo& file, const QString& path, const QString& savePath, DoneHandler done,
+    TransferHandler onTransfer, std::shared_ptr<const bool> aborted, int attempt) {
+    // 边下载边写盘边计算哈希，整个文件不会驻留在内存中
+    const QString mirror = mirrors.current();
+    const QString url = mirror + path;
+    auto sink = std::make_shared<DownloadSink>(savePath, file, mirror);
+    if (!sink->open()) {
+        done(false);
+        return;
+    }
+    if (sink->isComplete()) {
+        done(true);
+        return;
     }
 
-    // 验证文件哈希
-    emit progressChanged(-1, QString("正在校验文件: %1...") // -1 表示进度条不动
-        .arg(QString::fromStdString(file.filename)));
-    QString temp_hash = QCryptographicHash::hash(
-        response.get_payload_ByteArray(), QCryptographicHash::Md5
-    ).toHex();
+    HTTPRequest request = makeDownloadRequest(url);
+    sink->prepareRequest(request);
+    // 换镜像和等待后续传都由下面的完成回调负责，HTTPClient 不再自己重试，否则两层重试的次数会相乘
+    request.max_retries = 0;
+    request.SimpleDebug();
 
-    if (temp_hash != QString::fromStdString(file.hash)) {
-        qDebug() << "Hash mismatch for file: " << QString::fromStdString(file.filename)
-            << "Expected: " << QString::fromStdString(file.hash)
-            << "Got: " << temp_hash;
-        return false;
+    // 因为速度过低被中止的，和被调用方中止的区分开
+    auto tooSlow = std::make_shared<bool>(false);
+    HTTPTransfer* transfer = HTTPClient::getInstance().downloadAsync(request,
+        [sink](const char* data, qint64 size) {
+            return sink->write(data, size);
+        },
+        [this, sink, file, path, savePath, mirror, url, done, onTransfer, aborted, attempt, tooSlow](HTTPResponse& response) {
+            response.SimpleDebug();
+            bool ok = sink->finish(response);
+
+            metrics.recordRequest(url, response);
+            UpdateMetrics::FileStats stats = sink->stats();
+            stats.ok = ok;
+            stats.bytesTransferred = response.bytes_received;
+            stats.elapsedMs = response.elapsed_ms;
+            metrics.recordFile(stats);
+
+            // 镜像的问题（出错、内容不对、太慢）换一个镜像重试，网络中断留下的 .tmp 会从断点续传
+            bool mirrorFault = !ok && !sink->failedLocally()
+                && (response.error_code != QNetworkReply::NetworkError::OperationCanceledError || *tooSlow);
+            if (mirrorFault && attempt + 1 < mirrors.size()
+                && mirrors.reportFailure(mirror, *tooSlow ? "too slow" : QString::number(response.status_code))) {
+                downloadFile(file, path, savePath, done, onTransfer, aborted, attempt + 1);
+                return;
+            }
+            // 镜像都试过（或只有一个）时，暂时性的失败（中途断开、超时、5xx）等一会儿在同一个镜像上续传
+            bool transient = (response.error_code != QNetworkReply::NetworkError::NoError && response.status_code < 400)
+                || response.status_code >= 500 || response.status_code == 429;
+            int retry = attempt + 2 - mirrors.size();
+            if (mirrorFault && transient && !*tooSlow && retry <= config.maxRetries) {
+                int delayMs = HTTPClient::backoff_ms(retry);
+                qDebug() << "Download interrupted, resuming in " << delayMs << " ms: " << url;
+                QTimer::singleShot(delayMs, this, [this, file, path, savePath, done, onTransfer, aborted, attempt]() {
+                    // 等待期间调用方已经放弃（比如整批下载中别的文件失败了）
+                    if (aborted && *aborted) {
+                        done(false);
+                        return;
+                    }
+                    downloadFile(file, path, savePath, done, onTransfer, aborted, attempt + 1);
+                });
+                return;
+            }
+            done(ok);
+        },
+        [sink](const HTTPResponse& head) {
+            return sink->begin(head);
+        });
+
+    // 每个检测周期内收到的数据太少时中止，完成回调里换镜像续传
+    // 开启限速时速度是自己压下来的，不检测
+    const qint64 minBytesPerSecond = static_cast<qint64>(config.minThroughputKb) * 1024;
+    if (minBytesPerSecond > 0 && attempt + 1 < mirrors.size() && !RateLimiter::getInstance().enabled()) {
+        auto received = std::make_shared<qint64>(0);
+        auto checked = std::make_shared<qint64>(0);
+        connect(transfer, &HTTPTransfer::progress, transfer, [received](qint64 bytesReceived, qint64) {
+            *received = bytesReceived;
+        });
+        QTimer* watchdog = new QTimer(transfer);
+        connect(watchdog, &QTimer::timeout, transfer, [transfer, received, checked, tooSlow, minBytesPerSecond, url]() {
+            qint64 bytes = *received - *checked;
+            *checked = *received;
+            if (bytes * 1000 / THROUGHPUT_CHECK_MS < minBytesPerSecond) {
+                qDebug() << "Download too slow (" << bytes * 1000 / THROUGHPUT_CHECK_MS << " bytes/s): " << url;
+                *tooSlow = true;
+                transfer->abort();
+            }
+        });
+        watchdog->start(THROUGHPUT_CHECK_MS);
     }
 
-    // 保存文件
-    ofstream outFile(savePath.toStdString(), ios::binary);
-    if (!outFile) {
-        qDebug() << "Failed to open file for writing: " << savePath;
-        return false;
+    if (onTransfer) {
+        onTransfer(transfer);
     }
-    outFile.write(response.get_payload_ByteArray().data(), response.get_payload_ByteArray().size());
-    outFile.close();
+}
 
-    qDebug() << "Downloaded and verified: " << QString::fromStdString(file.filename);
-    return true;
+struct Updater::SegmentedDownload {
+    SegmentedDownload(const QString& tempPath, const FileInfo& file, qint64 size, const QString& validator)
+        : sink(tempPath, file, size, validator), file(file), tempPath(tempPath), validator(validator) {}
+
+    SegmentedSink sink;
+    FileInfo file;
+    QString path;
+    QString tempPath;
+    // 服务器的 ETag/Last-Modified，只有发往探测时那个镜像的请求才带 If-Range
+    QString validator;
+    QString validatorMirror;
+    DoneHandler done;
+    TransferHandler onTransfer;
+    ProgressHandler onProgress;
+
+    std::vector<QPointer<HTTPTransfer>> transfers;
+    int active = 0;
+    // 服务器没有按 Range 返回（不支持或文件已经变了），退回单连接下载
+    bool mismatch = false;
+    bool failed = false;
+    bool finished = false;
+
+    qint64 bytesTransferred = 0;
+    // 本次运行开始时已完成的字节数，算速度时扣掉
+    qint64 startBytes = 0;
+    QElapsedTimer clock;
+};
+
+void Updater::downloadSegmented(const FileInfo& file, const QString& path, const QString& tempPath, DoneHandler done,
+    TransferHandler onTransfer, ProgressHandler onProgress) {
+    auto sequential = [this, file, path, tempPath, done, onTransfer]() {
+        QFile::remove(SegmentedSink::statePath(tempPath));
+        downloadFile(file, path, tempPath, done, onTransfer);
+    };
+    // 已有单连接下载留下的断点时直接续传
+    if (config.downloadSegments <= 1 || QFile::exists(tempPath + ".meta")) {
+        sequential();
+        return;
+    }
+
+    // 先确认文件大小和服务器是否支持 Range；Range 针对原始字节，不能压缩
+    const QString mirror = mirrors.current();
+    HTTPRequest probe = makeDownloadRequest(mirror + path);
+    probe.http_method_type = HTTP_HEAD;
+    probe.accept_compressed = false;
+    probe.SimpleDebug();
+    HTTPClient::getInstance().sendAsync(probe,
+        [this, file, path, tempPath, done, onTransfer, onProgress, mirror, sequential, url = probe.url](HTTPResponse& response) {
+        response.SimpleDebug();
+        metrics.recordRequest(url, response);
+
+        const qint64 size = response.get_header("Content-Length").toLongLong();
+        const bool ranges = response.get_header("Accept-Ranges").compare("bytes", Qt::CaseInsensitive) == 0;
+        if (!response.is_Status_200() || !ranges || size < config.segmentThresholdMb * 1024LL * 1024) {
+            qDebug() << "Segmented download not used: " << response.status_code
+                << " size: " << size << " ranges: " << ranges;
+            sequential();
+            return;
+        }
+        QString validator = response.get_header("ETag");
+        if (validator.isEmpty()) {
+            validator = response.get_header("Last-Modified");
+        }
+
+        auto download = std::make_shared<SegmentedDownload>(tempPath, file, size, validator);
+        download->path = path;
+        download->validatorMirror = mirror;
+        download->done = done;
+        download->onTransfer = onTransfer;
+        download->onProgress = onProgress;
+        if (!download->sink.open(config.downloadSegments)) {
+            done(false);
+            return;
+        }
+        download->startBytes = download->sink.received();
+        download->clock.start();
+
+        qDebug() << "Segmented download: " << url << size << " bytes in " << download->sink.count() << " segments";
+        if (download->sink.allDone()) {
+            // 上次所有段都下完了，只是没来得及校验
+            completeSegmented(download, true);
+            return;
+        }
+        for (int i = 0; i < download->sink.count(); ++i) {
+            if (!download->sink.segment(i).done) {
+                fetchSegment(download, i);
+            }
+        }
+    });
+}
+
+void Updater::fetchSegment(std::shared_ptr<SegmentedDownload> download, int index) {
+    const SegmentedSink::Segment& segment = download->sink.segment(index);
+    const QString mirror = mirrors.current();
+    const QString url = mirror + download->path;
+    HTTPRequest request = makeDownloadRequest(url);
+    request.add_header("Range", QString("bytes=%1-%2").arg(segment.next).arg(segment.end - 1));
+    if (!download->validator.isEmpty() && mirror == download->validatorMirror) {
+        // 服务器上的文件变了时，服务器会忽略 Range 返回完整的200
+        request.add_header("If-Range", download->validator);
+    }
+    request.accept_compressed = false;
+    // 分段的意义在于多个TCP连接，HTTP/2 会把它们复用到同一个连接上
+    request.allow_http2 = false;
+    // 失败由 finishSegment 换镜像或等待后从断点接着下
+    request.max_retries = 0;
+    request.SimpleDebug();
+
+    ++download->active;
+    const qint64 expectedStart = segment.next;
+    download->transfers.push_back(HTTPClient::getInstance().downloadAsync(request,
+        [download, index](const char* data, qint64 size) {
+            if (!download->sink.write(index, data, size)) {
+                // 超出分段范围说明服务器没有按请求的 Range 返回
+                download->mismatch = !download->sink.failedLocally();
+                return false;
+            }
+            download->bytesTransferred += size;
+            if (download->onProgress) {
+                qint64 received = download->sink.received();
+                download->onProgress(received, download->sink.totalSize(),
+                    effectiveRate(received - download->startBytes, download->clock.elapsed()));
+            }
+            return true;
+        },
+        [this, download, index, mirror, url](HTTPResponse& response) {
+            response.SimpleDebug();
+            metrics.recordRequest(url, response);
+            finishSegment(download, index, mirror, response);
+        },
+        [download, expectedStart](const HTTPResponse& head) {
+            // Content-Range: bytes <start>-<end>/<total>
+            QString contentRange = head.get_header("Content-Range");
+            qint64 start = contentRange.section(' ', 1).section('-', 0, 0).toLongLong();
+            if (head.status_code != 206 || start != expectedStart) {
+                qDebug() << "Server ignored range request: " << head.status_code << contentRange;
+                download->mismatch = true;
+                return false;
+            }
+            return true;
+        }));
+}
+
+void Updater::finishSegment(std::shared_ptr<SegmentedDownload> download, int index, const QString& mirror,
+    const HTTPResponse& response) {
+    --download->active;
+    SegmentedSink::Segment& segment = download->sink.segment(index);
+    bool ok = response.error_code == QNetworkReply::NetworkError::NoError
+        && response.status_code == 206 && segment.next == segment.end;
+
+    if (ok) {
+        download->sink.markDone(index);
+    }
+    else if (!download->failed) {
+        // 每段最多在每个镜像上失败一次，再加上 maxRetries 次同一镜像上的重试
+        ++segment.failures;
+        if (download->mismatch || download->sink.failedLocally()
+            || segment.failures > config.maxRetries + mirrors.size() - 1) {
+            qDebug() << "Segment " << index << " failed: " << response.status_code << response.error_string;
+            download->failed = true;
+            for (const auto& transfer : download->transfers) {
+                if (transfer) {
+                    transfer->abort();
+                }
+            }
+        }
+        else if (mirrors.reportFailure(mirror, QString::number(response.status_code))) {
+            fetchSegment(download, index);
+        }
+        else {
+            int delayMs = HTTPClient::backoff_ms(segment.failures);
+            qDebug() << "Segment " << index << " interrupted at " << segment.next << ", resuming in " << delayMs << " ms";
+            QTimer::singleShot(delayMs, this, [this, download, index]() {
+                if (!download->failed) {
+                    fetchSegment(download, index);
+                }
+            });
+        }
+    }
+
+    // 中止其他分段时它们的回调会重入这里，只结束一次；等待重试的分段不算进 active
+    if (download->finished || download->active > 0) {
+        return;
+    }
+    if (download->failed) {
+        completeSegmented(download, false);
+    }
+    else if (download->sink.allDone()) {
+        completeSegmented(download, true);
+    }
+}
+
+void Updater::completeSegmented(std::shared_ptr<SegmentedDownload> download, bool allReceived) {
+    download->finished = true;
+    if (!allReceived && download->mismatch) {
+        qDebug() << "Falling back to single-connection download: " << download->path;
+        download->sink.discard();
+        downloadFile(download->file, download->path, download->tempPath, download->done, download->onTransfer);
+        return;
+    }
+
+    bool ok = false;
+    if (allReceived) {
+        ok = download->sink.verify();
+    }
+    else if (download->sink.failedLocally()) {
+        download->sink.discard();
+    }
+    else {
+        // 已完成的段留给下次续传
+        download->sink.close();
+    }
+
+    UpdateMetrics::FileStats stats = download->sink.stats();
+    stats.ok = ok;
+    stats.bytesTransferred = download->bytesTransferred;
+    stats.elapsedMs = download->clock.elapsed();
+    metrics.recordFile(stats);
+    download->done(ok);
+}
+
+QString Updater::usablePatchBase(const FileInfo& file) {
+    if (!config.useDeltaPatches) {
+        return QString();
+    }
+    // 本地旧文件的哈希在跳过检查时已经算过，这里直接从索引取
+    QString baseHash = localIndex.hashOf(QString::fromStdString(file.filename));
+    bool hasPatch = !baseHash.isEmpty() && std::find(file.patchFrom.begin(), file.patchFrom.end(),
+        baseHash.toStdString()) != file.patchFrom.end();
+    return hasPatch ? baseHash : QString();
+}
+
+void Updater::downloadOrPatchFile(const FileInfo& file, const QString& tempPath, DoneHandler done,
+    TransferHandler onTransfer, std::shared_ptr<const bool> aborted) {
+    QString localPath = QString::fromStdString(file.filename);
+    QString path = "/updater/" + localPath;
+
+    QString baseHash = usablePatchBase(file);
+    if (baseHash.isEmpty()) {
+        downloadFile(file, path, tempPath, done, onTransfer, aborted);
+        return;
+    }
+
+    // 补丁重建出的新文件同样边写 .tmp 边计算哈希
+    QFile::remove(tempPath + ".meta");
+    auto outFile = std::make_shared<QFile>(tempPath);
+    if (!outFile->open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qDebug() << "Failed to open file for writing: " << tempPath;
+        done(false);
+        return;
+    }
+    auto hasher = std::make_shared<QCryptographicHash>(QCryptographicHash::Md5);
+    auto stats = std::make_shared<UpdateMetrics::FileStats>();
+    stats->filename = localPath;
+    stats->source = "patch";
+    auto clock = std::make_shared<QElapsedTimer>();
+    clock->start();
+    auto patcher = std::make_shared<DeltaPatcher>(localPath, baseHash,
+        [outFile, hasher, stats, clock](const char* data, qint64 size) {
+            qint64 hashStart = clock->nsecsElapsed();
+            hasher->addData(data, static_cast<int>(size));
+            qint64 writeStart = clock->nsecsElapsed();
+            bool written = outFile->write(data, size) == size;
+            stats->hashNs += writeStart - hashStart;
+            stats->writeNs += clock->nsecsElapsed() - writeStart;
+            stats->bytesWritten += written ? size : 0;
+            return written;
+        });
+
+    QString patchUrl = mirrors.url("/updater/patches/" + baseHash + "_" + QString::fromStdString(file.hash) + ".patch");
+    HTTPRequest request = makeDownloadRequest(patchUrl);
+    request.SimpleDebug();
+
+    HTTPTransfer* transfer = HTTPClient::getInstance().downloadAsync(request,
+        [patcher](const char* data, qint64 size) {
+            return patcher->feed(data, size);
+        },
+        [this, file, path, patchUrl, tempPath, done, onTransfer, aborted, outFile, hasher, patcher, stats](HTTPResponse& response) {
+            response.SimpleDebug();
+            outFile->close();
+
+            bool patched = response.status_code == 200
+                && response.error_code == QNetworkReply::NetworkError::NoError
+                && patcher->finish()
+                && QString(hasher->result().toHex()) == QString::fromStdString(file.hash);
+
+            metrics.recordRequest(patchUrl, response);
+            stats->ok = patched;
+            stats->bytesTransferred = response.bytes_received;
+            stats->elapsedMs = response.elapsed_ms;
+            metrics.recordFile(*stats);
+            if (patched) {
+                qDebug() << "Patched and verified: " << QString::fromStdString(file.filename)
+                    << " patch bytes: " << response.get_header("Content-Length");
+                done(true);
+                return;
+            }
+
+            // 整批已经放弃、请求被中止时不再退回完整下载，否则会在批次结束后继续在后台下载
+            // 补丁内容有问题时 DeltaPatcher 也会中止请求，这时有错误信息，仍然退回完整下载
+            if (response.error_code == QNetworkReply::NetworkError::OperationCanceledError
+                && patcher->errorString().isEmpty()) {
+                qDebug() << "Delta patch download cancelled: " << QString::fromStdString(file.filename);
+                outFile->remove();
+                done(false);
+                return;
+            }
+
+            // 补丁不存在、本地旧文件不匹配或重建结果校验失败，退回完整下载
+            qDebug() << "Delta patch unusable, falling back to full download: "
+                << QString::fromStdString(file.filename) << patcher->errorString();
+            outFile->remove();
+            downloadFile(file, path, tempPath, done, onTransfer, aborted);
+        });
+    if (onTransfer) {
+        onTransfer(transfer);
+    }
+}
+
+void Updater::downloadFilesConcurrently(const std::vector<const FileInfo*>& files, DoneHandler done) {
+    // 这一批下载的共享状态，最后一个回调结束时释放
+    struct Batch {
+        std::vector<const FileInfo*> files;
+        size_t nextIndex = 0;
+        int running = 0;
+        int finishedFiles = 0;
+        bool failed = false;
+        // 整批放弃时置为true，正在等待重试的下载据此不再发出新请求
+        std::shared_ptr<bool> aborted = std::make_shared<bool>(false);
+        bool filling = false;
+        QElapsedTimer clock;
+        // 补丁失败退回完整下载时，原来的请求对象会被释放，所以用 QPointer 弱引用
+        std::map<const FileInfo*, QPointer<HTTPTransfer>> inFlight;
+        DoneHandler done;
+        std::function<void()> fillWindow;
+    };
+    auto batch = std::make_shared<Batch>();
+    batch->files = files;
+    batch->done = done;
+    batch->clock.start();
+
+    const int maxInFlight = config.maxConcurrentDownloads;
+    const int totalFiles = files.size();
+    qDebug() << "Downloading " << totalFiles << " files, max in flight: " << maxInFlight;
+
+    // 补上新的下载，保持窗口内请求数不超过上限；窗口清空时整批结束
+    // fillWindow 只弱引用 batch，避免 batch 自己持有自己导致无法释放
+    std::weak_ptr<Batch> weakBatch = batch;
+    batch->fillWindow = [this, weakBatch, maxInFlight, totalFiles]() {
+        auto batch = weakBatch.lock();
+        if (!batch || batch->filling) {
+            // 下载可能同步完成（比如续传时发现已经下完），此时由外层继续补窗口
+            return;
+        }
+        batch->filling = true;
+        while (!batch->failed && batch->running < maxInFlight && batch->nextIndex < batch->files.size()) {
+            const FileInfo* file = batch->files[batch->nextIndex++];
+            QString tempPath = QString::fromStdString(file->filename) + ".tmp";
+
+            ++batch->running;
+            downloadOrPatchFile(*file, tempPath, [this, batch, file, totalFiles](bool ok) {
+                --batch->running;
+                batch->inFlight.erase(file);
+
+                if (ok) {
+                    ++batch->finishedFiles;
+                    // 文件大小未知，按已完成文件的平均耗时估算剩余时间，限速时自然反映限速后的速度
+                    QString text = QString("已下载文件: %1 (%2/%3)")
+                        .arg(QString::fromStdString(file->filename))
+                        .arg(batch->finishedFiles)
+                        .arg(totalFiles);
+                    int remainingFiles = totalFiles - batch->finishedFiles;
+                    if (remainingFiles > 0) {
+                        qint64 etaMs = batch->clock.elapsed() * remainingFiles / batch->finishedFiles;
+                        text += "，" + formatEta(etaMs / 1000);
+                    }
+                    emit progressChanged(40 + 55 * batch->finishedFiles / totalFiles, text);
+                }
+                else if (!batch->failed) {
+                    // 任意一个失败就放弃整批，中止其余进行中的请求
+                    batch->failed = true;
+                    *batch->aborted = true;
+                    auto transfers = batch->inFlight;
+                    for (auto& item : transfers) {
+                        if (item.second) {
+                            item.second->abort();
+                        }
+                    }
+                }
+
+                batch->fillWindow();
+            },
+            [batch, file](HTTPTransfer* transfer) {
+                batch->inFlight[file] = transfer;
+            },
+            batch->aborted);
+        }
+        batch->filling = false;
+
+        if (batch->running == 0 && batch->done) {
+            // 整批结束，只回调一次
+            DoneHandler batchDone = std::move(batch->done);
+            batch->done = nullptr;
+            batchDone(!batch->failed && batch->finishedFiles == totalFiles);
+        }
+    };
+
+    emit progressChanged(40, QString("正在下载 %1 个文件...").arg(totalFiles));
+    batch->fillWindow();
 }
 
 bool Updater::applyUpdate(const FileInfo& file) {
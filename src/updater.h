@@ -1,18 +1,29 @@
 ﻿#pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <memory>
+#include <functional>
 
 #include <QObject>
+#include <QJsonObject>
 
 #include "versionComparator.h"
+#include "localIndex.h"
+#include "updaterConfig.h"
+#include "artifactStore.h"
+#include "updateMetrics.h"
+#include "mirrorSet.h"
+#include "manifestTable.h"
 
 
-struct FileInfo {
-    std::string filename;
-    std::string hash;
-};
+class HTTPTransfer;
+class HTTPResponse;
+
+// 本程序对应的安装包版本，格式在编译期检查
+constexpr std::string_view INSTALLER_VERSION = "2.0.0";
+static_assert(SemanticVersion::parse(INSTALLER_VERSION).valid, "INSTALLER_VERSION is not a valid SemVer version");
 
 // ======================
 // 更新器主体（外观模式）
@@ -22,9 +33,16 @@ class Updater : public QObject
     Q_OBJECT
 
 public:
-    explicit Updater(std::unique_ptr<VersionComparator> comparator, QObject* parent = nullptr);
+    explicit Updater(std::unique_ptr<VersionComparator> comparator,
+        UpdaterConfig config = UpdaterConfig::load(), QObject* parent = nullptr);
     ~Updater();
 
+    // 只检查是否有更新，发现更新时发出 updateAvailable 后直接结束，不下载也不修改文件
+    void setCheckOnly(bool checkOnly);
+    // 校验模式：不信任本地索引，并行重新计算所有热更新文件的哈希，只下载缺失或损坏的文件
+    // 和 setCheckOnly 同时使用时只报告，不修复
+    void setVerify(bool verify);
+
 public slots:
     // 这是将在新线程中执行的核心函数
     void process();
@@ -33,11 +51,17 @@ signals:
     // 信号：更新进度和状态文本
     void progressChanged(int value, const QString& text);
 signals:
-    // 信号：通知UI层启动主程序
-    void launchProgramRequested(const QString& programPath);
+    // 信号：通知UI层启动主程序，launchedEarly 为true表示先启动模式下提前启动，更新还会在后台继续
+    void launchProgramRequested(const QString& programPath, bool launchedEarly);
 signals:
     // 信号：通知UI层启动安装程序
     void launchInstallerRequested(const QString& installerPath);
+signals:
+    // 信号：检查到可用更新，kind 为 "installer"、"hotfix" 或 "repair"（校验模式下版本相同但有文件损坏）
+    void updateAvailable(const QString& kind, const QString& version);
+signals:
+    // 信号：校验模式下发现本地文件缺失或与版本信息不一致
+    void fileCorrupted(const QString& path);
 signals:
     // 信号：整个更新流程结束
     void finished(bool success, const QString& message);
@@ -45,26 +69,135 @@ signals:
 private:
     std::unique_ptr<VersionComparator> comparator;
 
+    UpdaterConfig config;
+
     std::string mainProgram;
 
-    const QString baseUrl = "http://localhost:8000";
-    //const QString baseUrl = "http://localhost:8000";
+    bool checkOnly = false;
+    bool verify = false;
+    // 校验模式下发现的缺失或损坏的文件数
+    int corruptedFiles = 0;
+
+    // 先启动模式下主程序已经在检查更新之前启动
+    bool launchedEarly = false;
+
+    // 服务器地址，来自 updater.ini 的 server/base_url 和 server/mirrors
+    MirrorSet mirrors{ QStringList{ config.baseUrl } + config.mirrors };
+    // 镜像只在第一次需要访问网络时探测一次
+    bool mirrorsProbed = false;
 
     // 需要安装包更新的大版本号
-    const std::string installerVersion = "2.0.0";
+    const std::string installerVersion{ INSTALLER_VERSION };
     std::string remoteInstallerVersion;
     std::string installerHash;
 
     // 热更新 hotfix 版本文件
     const std::string hotfixVersionFile = "version";
     int remotehotfixVersion = -1;
-    std::vector<FileInfo> hotfixFileList;
-
-    bool getRemoteVersion();
-
-    bool downloadAndPrepareInstaller(const QString& installerName);
-    bool downloadAndApplyHotfix();
-
-    bool downloadFile(const FileInfo& file, const QString& url, const QString& tempPath);
+    // 版本信息中的全部热更新文件
+    ManifestTable hotfixFiles;
+    // 服务器为该热更新版本发布的打包文件（/updater/ 下的相对路径），没有时为空
+    std::string hotfixBundle;
+
+    // 上一次拿到的版本信息及其 ETag/Last-Modified
+    const QString manifestCacheFile = "manifest.cache";
+
+    // 本地文件哈希索引，已是目标版本的文件不再重复下载
+    LocalFileIndex localIndex{ "updater.index" };
+
+    // 按哈希保存的热更新文件历史版本，用于本地回滚和去重
+    ArtifactStore artifactStore{ ".store", config.storeKeepVersions };
+    const QString commitJournalFile = ".store/journal.json";
+    // 先启动模式下后台准备好、等下次启动时提交的更新：{ "kind": "hotfix"|"installer", "manifest": 版本信息 }
+    const QString stagedUpdateFile = ".store/staged.json";
+
+    // 每次运行的分阶段耗时统计，流程结束时写入 metricsFile
+    UpdateMetrics metrics;
+    const QString metricsFile = "updater.metrics.json";
+
+    // 异步步骤完成时的回调，ok 表示该步骤是否成功
+    using DoneHandler = std::function<void(bool ok)>;
+
+    // 一个文件的下载每发出一个请求（包括换镜像重试）回调一次，用于跟踪进度或中止
+    using TransferHandler = std::function<void(HTTPTransfer* transfer)>;
+    // 一个文件的整体下载进度，rate 是本次运行的平均速度（字节/秒），未知时为0
+    using ProgressHandler = std::function<void(qint64 received, qint64 total, double rate)>;
+    // 分段下载的进行状态，定义在 updater.cpp
+    struct SegmentedDownload;
+
+    // 获取远程版本信息，带本地缓存：有效期内直接用缓存，过期后用 ETag/Last-Modified 向服务器确认
+    // 服务器出错时换下一个镜像重试，attempt 是已经尝试过的次数
+    void getRemoteVersion(DoneHandler done, int attempt = 0);
+    // 解析 JSON 或 CBOR 版本信息，都转成 ManifestTable 后由 useManifest 取用
+    bool parseManifest(const QJsonObject& manifest);
+    bool parseManifest(const QByteArray& cbor);
+    bool useManifest(ManifestTable&& manifest);
+    // 拿到远程版本信息之后的流程：比较版本，决定走安装包更新还是热更新
+    void checkForUpdates();
+    // 安装包已是最新之后的流程：检查并应用热更新
+    void checkHotfix();
+    // 在线程池中并行计算 hotfixFiles 中所有本地文件的哈希并写回索引，统计 corruptedFiles
+    void verifyHotfixFiles(DoneHandler done);
+
+    void downloadAndPrepareInstaller(const QString& installerName, DoneHandler done);
+    // 把热更新文件从 fromVersion 更新（或回滚）到 remotehotfixVersion
+    // 先把所有文件下载校验进本地仓库，再在一个很短的、有日志保护的提交阶段统一替换
+    // stageOnly 为true时文件进仓库后就结束，不修改安装目录
+    void downloadAndApplyHotfix(int fromVersion, bool stageOnly, DoneHandler done);
+    // 对比本地文件和 hotfixFiles：changed 是需要替换的文件，missing 指向其中本地仓库也没有、
+    // 需要下载的文件（按哈希去重），previous 记录本地文件当前的哈希
+    // 只有 changed 的条目展开成 FileInfo，missing 中的指针在 changed 不再修改时有效
+    void scanHotfixFiles(std::vector<FileInfo>& changed, std::vector<const FileInfo*>& missing,
+        ArtifactStore::Snapshot& previous);
+
+    // 先启动模式：用缓存的版本信息立即启动主程序，之后的工作降低优先级在后台进行
+    bool launchBeforeCheck();
+    // 请求启动主程序，已经提前启动过时不再重复
+    void requestProgramLaunch();
+    // 记录后台已准备好的更新
+    void writeStagedUpdate(const QString& kind);
+    // 提交上次后台准备好的更新，返回true表示准备好的是安装包且已请求启动
+    bool applyStagedUpdate();
+    // 文件都已在仓库中时直接提交 hotfixFiles，不访问网络
+    bool commitStagedHotfix(int fromVersion);
+
+    // 提交阶段：写日志 -> 从仓库放置文件 -> 写版本号 -> 删除日志
+    bool commitHotfix(int fromVersion, const std::vector<FileInfo>& files,
+        const ArtifactStore::Snapshot& previous);
+    // 按日志前滚（forward）或回滚，可重复执行
+    bool replayCommitJournal(const QJsonObject& journal, bool forward);
+    // 启动时检查上次的提交是否被打断
+    void recoverInterruptedCommit();
+
+    // 从当前镜像下载 path（以 '/' 开头）到 tempPath 并校验哈希，上次中断留下的 .tmp 会被续传
+    // 镜像出错、内容校验失败或速度过低时，换下一个镜像从断点继续，每个镜像最多试一次
+    // 不需要发请求（已下完）或无法开始时 done 被同步调用，onTransfer 不会被调用
+    // 等待重试期间没有进行中的请求可以中止，aborted 变为true时不再重试，直接 done(false)
+    void downloadFile(const FileInfo& file, const QString& path, const QString& tempPath, DoneHandler done,
+        TransferHandler onTransfer = nullptr, std::shared_ptr<const bool> aborted = nullptr, int attempt = 0);
+    // 本地旧文件有对应的差分补丁时，下载补丁并在本地重建新文件；
+    // 没有补丁或补丁应用失败时退回 downloadFile 完整下载
+    void downloadOrPatchFile(const FileInfo& file, const QString& tempPath, DoneHandler done,
+        TransferHandler onTransfer = nullptr, std::shared_ptr<const bool> aborted = nullptr);
+    // 大文件分段并发下载：先用 HEAD 确认大小和 Range 支持，每段用一个连接写进预先分配好的 .tmp 的对应区间，
+    // 失败的段从断点重新请求，全部完成后整体校验哈希；中断后只重新下载没完成的段
+    // 文件太小、服务器不支持 Range 或已有单连接下载的断点时，退回 downloadFile
+    void downloadSegmented(const FileInfo& file, const QString& path, const QString& tempPath, DoneHandler done,
+        TransferHandler onTransfer, ProgressHandler onProgress);
+    // 请求分段 index 还没下载的部分
+    void fetchSegment(std::shared_ptr<SegmentedDownload> download, int index);
+    // 分段请求结束后的处理：标记完成、换镜像或等待后重试，或者让整个下载失败
+    void finishSegment(std::shared_ptr<SegmentedDownload> download, int index, const QString& mirror,
+        const HTTPResponse& response);
+    // 所有分段都结束后：校验整个文件，或者失败（服务器不按 Range 返回时退回单连接下载）
+    void completeSegmented(std::shared_ptr<SegmentedDownload> download, bool allReceived);
+    // 本地旧文件有对应的差分补丁时返回旧文件哈希，否则返回空
+    QString usablePatchBase(const FileInfo& file);
+    // 流式下载热更新打包文件，把 files 中的文件边收边解进本地仓库
+    // 失败时已经解出的文件仍留在仓库中，调用方只需补下剩下的
+    void downloadBundle(const std::vector<const FileInfo*>& files, DoneHandler done);
+    // 并发下载一批文件到各自的 .tmp，同时进行的请求数不超过 config.maxConcurrentDownloads
+    // 全部下载并校验通过才回调 done(true)，任意一个失败会中止其余请求
+    void downloadFilesConcurrently(const std::vector<const FileInfo*>& files, DoneHandler done);
     bool applyUpdate(const FileInfo& file);
 };
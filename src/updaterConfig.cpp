@@ -0,0 +1,45 @@
+﻿#include "updaterConfig.h"
+
+#include <QSettings>
+#include <QtGlobal>
+
+
+UpdaterConfig UpdaterConfig::load(const QString& path) {
+    UpdaterConfig config;
+    QSettings settings(path, QSettings::IniFormat);
+
+    config.baseUrl = settings.value("server/base_url", config.baseUrl).toString();
+    config.mirrors = settings.value("server/mirrors", config.mirrors).toStringList();
+    config.probeTimeoutMs = qMax(100, settings.value("server/probe_timeout_ms", config.probeTimeoutMs).toInt());
+
+    config.connectTimeoutMs = qMax(0, settings.value("network/connect_timeout_ms", config.connectTimeoutMs).toInt());
+    config.idleTimeoutMs = qMax(0, settings.value("network/idle_timeout_ms", config.idleTimeoutMs).toInt());
+    config.maxRetries = qBound(0, settings.value("network/max_retries", config.maxRetries).toInt(), 10);
+
+    config.maxConcurrentDownloads = qBound(1,
+        settings.value("download/max_concurrent", config.maxConcurrentDownloads).toInt(), 16);
+    config.useDeltaPatches = settings.value("download/delta", config.useDeltaPatches).toBool();
+    config.useBundles = settings.value("download/bundle", config.useBundles).toBool();
+    config.maxRateKb = qMax(0, settings.value("download/max_rate_kb", config.maxRateKb).toInt());
+    config.adaptiveRate = settings.value("download/adaptive_rate", config.adaptiveRate).toBool();
+    config.minRateKb = qMax(1, settings.value("download/min_rate_kb", config.minRateKb).toInt());
+    config.sharedRate = settings.value("download/shared_rate", config.sharedRate).toBool();
+    config.minThroughputKb = qMax(0, settings.value("download/min_throughput_kb", config.minThroughputKb).toInt());
+    config.downloadSegments = qBound(1, settings.value("download/segments", config.downloadSegments).toInt(), 6);
+    config.segmentThresholdMb = qMax(1, settings.value("download/segment_threshold_mb", config.segmentThresholdMb).toInt());
+
+    config.manifestMaxAge = qMax(0, settings.value("manifest/max_age", config.manifestMaxAge).toInt());
+    config.binaryManifest = settings.value("manifest/binary", config.binaryManifest).toBool();
+    config.manifestHedge = settings.value("manifest/hedge", config.manifestHedge).toBool();
+    config.hedgePercentile = qBound(50, settings.value("manifest/hedge_percentile", config.hedgePercentile).toInt(), 99);
+
+    config.storeKeepVersions = qMax(1, settings.value("store/keep_versions", config.storeKeepVersions).toInt());
+    config.allowRollback = settings.value("store/allow_rollback", config.allowRollback).toBool();
+
+    config.launchFirst = settings.value("startup/launch_first", config.launchFirst).toBool();
+
+    config.logHttp = settings.value("log/http", config.logHttp).toBool();
+    config.logBodyPreview = qMax(0, settings.value("log/body_preview", config.logBodyPreview).toInt());
+
+    return config;
+}
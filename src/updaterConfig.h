@@ -0,0 +1,105 @@
+﻿#pragma once
+
+#include <QString>
+#include <QStringList>
+
+
+// ======================
+// 更新器运行配置
+// ======================
+// 从程序目录下的 updater.ini 读取，文件或字段不存在时使用默认值
+// 示例：
+//   [server]
+//   base_url=http://localhost:8000
+//   mirrors=http://mirror1:8000, http://mirror2:8000
+//   probe_timeout_ms=2000
+//   [network]
+//   connect_timeout_ms=15000
+//   idle_timeout_ms=30000
+//   max_retries=2
+//   [download]
+//   max_concurrent=4
+//   delta=true
+//   bundle=true
+//   max_rate_kb=0
+//   min_rate_kb=64
+//   adaptive_rate=false
+//   shared_rate=false
+//   min_throughput_kb=0
+//   segments=4
+//   segment_threshold_mb=64
+//   [manifest]
+//   max_age=0
+//   binary=true
+//   hedge=true
+//   hedge_percentile=95
+//   [store]
+//   keep_versions=3
+//   allow_rollback=false
+//   [startup]
+//   launch_first=false
+//   [log]
+//   http=false
+//   body_preview=512
+struct UpdaterConfig {
+    // 更新服务器地址
+    QString baseUrl = "http://localhost:8000";
+    // 内容相同的备用服务器，启动时和 baseUrl 一起探测，选响应最快的，出错或太慢时切换
+    QStringList mirrors;
+    // 探测镜像的超时（毫秒），超时的镜像排到最后
+    int probeTimeoutMs = 2000;
+
+    // 请求超时（毫秒），0 表示不限制：连接超时是等响应头的时间，空闲超时是收到响应头之后连续没有数据的时间
+    int connectTimeoutMs = 15000;
+    int idleTimeoutMs = 30000;
+    // 超时、网络错误、5xx 时的重试次数，每次重试前等待的时间指数增加并带随机抖动
+    // 下载中途断开时从断点续传，有多个镜像时先换镜像
+    int maxRetries = 2;
+
+    // 热更新文件并发下载的最大请求数，1 表示逐个下载
+    // HTTP/1.1 下Qt对每个主机最多开6个连接，超出的请求在Qt内部排队；HTTP/2 下共用一个连接
+    int maxConcurrentDownloads = 4;
+    // 服务器发布了差分补丁时优先下载补丁
+    bool useDeltaPatches = true;
+    // 服务器发布了热更新打包文件、且大部分文件需要下载时，整包下载代替逐个请求
+    bool useBundles = true;
+
+    // 下载限速（KiB/s），0 表示不限速，限制的是进程内所有下载的总速率
+    int maxRateKb = 0;
+    // 自适应限速：检测到延迟升高（出口链路排队）时降低速率，之后逐步恢复，不低于 minRateKb
+    bool adaptiveRate = false;
+    int minRateKb = 64;
+    // 同一台机器上的所有更新器实例共用一个限速，适合很多机器同时更新、共用出口带宽的场合
+    bool sharedRate = false;
+    // 下载速度低于这个值（KiB/s）持续一个检测周期时放弃当前镜像，从断点换到下一个镜像继续
+    // 0 表示不检测；只有一个镜像或开启了限速时也不检测
+    int minThroughputKb = 0;
+    // 安装包不小于 segmentThresholdMb 时分成 downloadSegments 段，各用一个连接并发下载，1 表示不分段
+    // 用于延迟高、单个TCP连接跑不满带宽的链路；服务器要支持 Range，Qt 对每个主机最多开6个连接
+    int downloadSegments = 4;
+    int segmentThresholdMb = 64;
+
+    // 版本信息缓存的有效期（秒），有效期内启动时不访问网络，0 表示每次都向服务器确认
+    int manifestMaxAge = 0;
+    // 向服务器请求 CBOR 格式的版本信息（服务器不支持时仍返回 JSON），文件很多时解析更快、占用内存更少
+    bool binaryManifest = true;
+    // 获取版本信息的请求超过最近耗时的 hedgePercentile 百分位还没有结果时，再发一个相同的请求
+    // （有镜像时发往另一个镜像），用先返回的那个；少量额外请求换取启动时更稳定的等待时间
+    bool manifestHedge = true;
+    int hedgePercentile = 95;
+
+    // 本地仓库保留最近几个热更新版本的文件，用于本地回滚
+    int storeKeepVersions = 3;
+    // 服务器的热更新版本号比本地小时回滚到服务器的版本；默认不回滚，本地版本更新时当作特殊版本保留
+    bool allowRollback = false;
+
+    // 先启动主程序，检查和下载在后台进行，准备好的更新在下次启动时提交
+    bool launchFirst = false;
+
+    // 是否记录每个HTTP请求/响应的详情（updater.http 分类的调试日志）
+    bool logHttp = false;
+    // HTTP 详情中请求/响应体最多记录的字节数
+    int logBodyPreview = 512;
+
+    static UpdaterConfig load(const QString& path = "updater.ini");
+};
@@ -10,6 +10,7 @@
 #include <QMessageBox>
 #include <QCloseEvent>
 #include <QTimer>
+#include <QCoreApplication>
 
 #include <QDebug>
 
@@ -125,13 +126,22 @@ void UpdaterUI::onUpdateProgress(int value, const QString& text)
     }
 }
 
-void UpdaterUI::onLaunchProgramRequested(const QString& programPath)
+void UpdaterUI::onLaunchProgramRequested(const QString& programPath, bool launchedEarly)
 {
     if (!QProcess::startDetached(programPath, QStringList())) {
         qDebug() << "Failed to launch main program: " << programPath;
         launchSuccess = -1; // 标记启动主程序失败
         // Todo: 显示完整程序路径和启动失败原因
         QMessageBox::critical(this, "启动失败", "无法启动主程序: " + programPath);
+        return;
+    }
+
+    // 先启动模式：主程序已经启动而更新还没结束，隐藏窗口让更新在后台继续
+    // 正常流程里启动请求也比 finished 先到，不能用 workerFinished 判断
+    if (launchedEarly) {
+        qDebug() << "Main program launched before update finished, continuing in background.";
+        runningInBackground = true;
+        hide();
     }
 }
 
@@ -149,6 +159,14 @@ void UpdaterUI::onUpdateFinished(bool workerSuccess, const QString& message)
 {
     workerFinished = true; // 标记更新流程结束
     statusLabel->setText(message);
+
+    // 窗口已经隐藏，不再提示用户，等工作线程退出后直接结束进程
+    if (runningInBackground) {
+        qDebug() << "Background update finished: " << workerSuccess << message;
+        connect(workerThread, &QThread::finished, qApp, &QCoreApplication::quit);
+        return;
+    }
+
     if (workerSuccess && this->launchSuccess == 1) {
         qDebug() << "Update completed successfully: " << message;
         progressBar->setValue(100);
@@ -30,7 +30,7 @@ private slots:
     void onUpdateProgress(int value, const QString& text);
 
     // 槽：响应worker的启动主程序信号
-    void onLaunchProgramRequested(const QString& programPath);
+    void onLaunchProgramRequested(const QString& programPath, bool launchedEarly);
 
     // 槽：响应worker的启动安装程序信号
     void onLaunchInstallerRequested(const QString& installerPath);
@@ -54,4 +54,5 @@ private:
     bool workerFinished = false;
 
     int launchSuccess = 1; // 标记更新后是否启动对应程序
+    bool runningInBackground = false; // 主程序已提前启动，窗口隐藏，更新在后台继续
 };
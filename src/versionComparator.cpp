@@ -4,28 +4,42 @@
 
 using namespace std;
 
-bool SemanticVersionComparator::isNewer(const string& remote, const string& local) {
-    auto remoteParts = splitVersion(remote);
-    auto localParts = splitVersion(local);
+// SemVer 2.0 规范中的优先级示例，在编译期检查
+static_assert(SemanticVersion::parse("1.0.0").valid, "plain version");
+static_assert(SemanticVersion::parse("2.0").valid && SemanticVersion::parse("2.0").patch == 0, "short version");
+static_assert(SemanticVersion::parse("1.0.0-alpha+001").build == "001", "build metadata");
+static_assert(!SemanticVersion::parse("").valid, "empty");
+static_assert(!SemanticVersion::parse("01.0.0").valid, "leading zero");
+static_assert(!SemanticVersion::parse("1.0.0-01").valid, "leading zero in pre-release");
+static_assert(!SemanticVersion::parse("1.0.0-").valid, "empty pre-release");
+static_assert(!SemanticVersion::parse("1.0.0-a..b").valid, "empty identifier");
+static_assert(!SemanticVersion::parse("1.0.0.1").valid, "too many parts");
+static_assert(!SemanticVersion::parse("1.0.0-rc_1").valid, "invalid character");
+static_assert(!SemanticVersion::parse("18446744073709551616.0.0").valid, "overflow");
 
-    for (size_t i = 0; i < min(remoteParts.size(), localParts.size()); ++i) {
-        if (remoteParts[i] > localParts[i]) return true;
-        if (remoteParts[i] < localParts[i]) return false;
-    }
-    return remoteParts.size() > localParts.size();
+static constexpr bool olderThan(std::string_view a, std::string_view b) {
+    return SemanticVersion::compare(SemanticVersion::parse(a), SemanticVersion::parse(b)) < 0
+        && SemanticVersion::compare(SemanticVersion::parse(b), SemanticVersion::parse(a)) > 0;
 }
+static_assert(olderThan("1.0.0", "2.0.0") && olderThan("2.0.0", "2.1.0") && olderThan("2.1.0", "2.1.1"), "core");
+static_assert(olderThan("1.9.0", "1.10.0"), "numeric core");
+static_assert(olderThan("1.0.0-alpha", "1.0.0-alpha.1"), "pre-release 1");
+static_assert(olderThan("1.0.0-alpha.1", "1.0.0-alpha.beta"), "pre-release 2");
+static_assert(olderThan("1.0.0-alpha.beta", "1.0.0-beta"), "pre-release 3");
+static_assert(olderThan("1.0.0-beta", "1.0.0-beta.2"), "pre-release 4");
+static_assert(olderThan("1.0.0-beta.2", "1.0.0-beta.11"), "pre-release 5");
+static_assert(olderThan("1.0.0-beta.11", "1.0.0-rc.1"), "pre-release 6");
+static_assert(olderThan("1.0.0-rc.1", "1.0.0"), "pre-release 7");
+static_assert(SemanticVersion::compare(SemanticVersion::parse("1.0.0+a"), SemanticVersion::parse("1.0.0+b")) == 0,
+    "build metadata ignored");
 
-vector<int> SemanticVersionComparator::splitVersion(const string& version) {
-    vector<int> parts;
-    size_t start = 0;
-    size_t end = version.find('.');
-    while (end != string::npos) {
-        parts.push_back(stoi(version.substr(start, end - start)));
-        start = end + 1;
-        end = version.find('.', start);
+bool SemanticVersionComparator::isNewer(const string& remote, const string& local) {
+    const SemanticVersion remoteVersion = SemanticVersion::parse(remote);
+    const SemanticVersion localVersion = SemanticVersion::parse(local);
+    if (!remoteVersion.valid || !localVersion.valid) {
+        return false;
     }
-    parts.push_back(stoi(version.substr(start)));
-    return parts;
+    return SemanticVersion::compare(remoteVersion, localVersion) > 0;
 }
 
 bool TimestampVersionComparator::isNewer(const string& remote, const string& local) {
@@ -1,10 +1,194 @@
 ﻿#pragma once
 #include <string>
-#include <vector>
+#include <string_view>
+#include <cstdint>
 #include <ctime>
 #include <sstream>
 
 
+// ======================
+// SemVer 2.0 版本号
+// ======================
+// 直接在 std::string_view 上解析，不分配内存、不抛异常，可以在编译期使用
+// 格式：主.次.修订[-预发布标识][+构建元数据]，次和修订可以省略（按0处理，兼容 "2.0" 这样的旧版本号）
+// 预发布标识和构建元数据只是指向原字符串的视图，原字符串必须比解析结果活得久
+struct SemanticVersion {
+    std::uint64_t major = 0;
+    std::uint64_t minor = 0;
+    std::uint64_t patch = 0;
+    std::string_view preRelease;    // 不含 '-'，为空表示正式版本
+    std::string_view build;         // 不含 '+'，不参与比较
+    bool valid = false;
+
+    // 解析失败时返回 valid 为false的结果
+    static constexpr SemanticVersion parse(std::string_view text) noexcept;
+
+    // 按 SemVer 2.0 的优先级比较：a 较旧返回负数，相同返回0，a 较新返回正数
+    // 构建元数据不参与比较
+    static constexpr int compare(const SemanticVersion& a, const SemanticVersion& b) noexcept;
+
+private:
+    static constexpr bool isDigit(char c) noexcept {
+        return c >= '0' && c <= '9';
+    }
+    static constexpr bool isIdentifierChar(char c) noexcept {
+        return isDigit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '-';
+    }
+    static constexpr bool isNumeric(std::string_view identifier) noexcept {
+        for (char c : identifier) {
+            if (!isDigit(c)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    // 数字部分：不能为空，不能有前导0，不能溢出
+    static constexpr bool parseNumber(std::string_view text, std::size_t& pos, std::uint64_t& value) noexcept;
+    // 以 '.' 分隔的标识符列表：每个标识符非空、只含 [0-9A-Za-z-]，
+    // checkLeadingZero 为true时（预发布标识）纯数字标识符不能有前导0
+    static constexpr bool validIdentifiers(std::string_view text, bool checkLeadingZero) noexcept;
+    // 取出从 pos 开始的下一个标识符，pos 移到下一个标识符的开头
+    static constexpr std::string_view nextIdentifier(std::string_view text, std::size_t& pos) noexcept;
+    static constexpr int comparePreRelease(std::string_view a, std::string_view b) noexcept;
+};
+
+constexpr bool SemanticVersion::parseNumber(std::string_view text, std::size_t& pos, std::uint64_t& value) noexcept {
+    const std::size_t start = pos;
+    value = 0;
+    while (pos < text.size() && isDigit(text[pos])) {
+        const std::uint64_t digit = static_cast<std::uint64_t>(text[pos] - '0');
+        if (value > (UINT64_MAX - digit) / 10) {
+            return false;
+        }
+        value = value * 10 + digit;
+        ++pos;
+    }
+    if (pos == start) {
+        return false;
+    }
+    return !(text[start] == '0' && pos - start > 1);
+}
+
+constexpr std::string_view SemanticVersion::nextIdentifier(std::string_view text, std::size_t& pos) noexcept {
+    const std::size_t start = pos;
+    while (pos < text.size() && text[pos] != '.') {
+        ++pos;
+    }
+    std::string_view identifier = text.substr(start, pos - start);
+    if (pos < text.size()) {
+        ++pos;
+    }
+    return identifier;
+}
+
+constexpr bool SemanticVersion::validIdentifiers(std::string_view text, bool checkLeadingZero) noexcept {
+    if (text.empty() || text.back() == '.') {
+        return false;
+    }
+    std::size_t pos = 0;
+    while (pos < text.size()) {
+        std::string_view identifier = nextIdentifier(text, pos);
+        if (identifier.empty()) {
+            return false;
+        }
+        for (char c : identifier) {
+            if (!isIdentifierChar(c)) {
+                return false;
+            }
+        }
+        if (checkLeadingZero && identifier.size() > 1 && identifier[0] == '0' && isNumeric(identifier)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+constexpr SemanticVersion SemanticVersion::parse(std::string_view text) noexcept {
+    SemanticVersion version;
+    std::size_t pos = 0;
+    if (!parseNumber(text, pos, version.major)) {
+        return version;
+    }
+    if (pos < text.size() && text[pos] == '.') {
+        ++pos;
+        if (!parseNumber(text, pos, version.minor)) {
+            return version;
+        }
+        if (pos < text.size() && text[pos] == '.') {
+            ++pos;
+            if (!parseNumber(text, pos, version.patch)) {
+                return version;
+            }
+        }
+    }
+
+    const std::size_t plus = text.find('+', pos);
+    std::string_view rest = text.substr(pos, plus == std::string_view::npos ? std::string_view::npos : plus - pos);
+    if (!rest.empty()) {
+        if (rest[0] != '-' || !validIdentifiers(rest.substr(1), true)) {
+            return version;
+        }
+        version.preRelease = rest.substr(1);
+    }
+    if (plus != std::string_view::npos) {
+        version.build = text.substr(plus + 1);
+        if (!validIdentifiers(version.build, false)) {
+            return version;
+        }
+    }
+    version.valid = true;
+    return version;
+}
+
+constexpr int SemanticVersion::comparePreRelease(std::string_view a, std::string_view b) noexcept {
+    // 有预发布标识的版本比对应的正式版本旧
+    if (a.empty() || b.empty()) {
+        return a.empty() == b.empty() ? 0 : (a.empty() ? 1 : -1);
+    }
+    std::size_t posA = 0;
+    std::size_t posB = 0;
+    while (posA < a.size() && posB < b.size()) {
+        std::string_view idA = nextIdentifier(a, posA);
+        std::string_view idB = nextIdentifier(b, posB);
+        const bool numericA = isNumeric(idA);
+        const bool numericB = isNumeric(idB);
+        if (numericA != numericB) {
+            // 纯数字标识符比含字母的旧
+            return numericA ? -1 : 1;
+        }
+        if (numericA && idA.size() != idB.size()) {
+            // 没有前导0，位数多的数值大，不需要转换成整数（也就不会溢出）
+            return idA.size() < idB.size() ? -1 : 1;
+        }
+        const int order = idA.compare(idB);
+        if (order != 0) {
+            return order < 0 ? -1 : 1;
+        }
+    }
+    // 前面都相同时标识符多的较新
+    if (posA < a.size()) {
+        return 1;
+    }
+    if (posB < b.size()) {
+        return -1;
+    }
+    return 0;
+}
+
+constexpr int SemanticVersion::compare(const SemanticVersion& a, const SemanticVersion& b) noexcept {
+    if (a.major != b.major) {
+        return a.major < b.major ? -1 : 1;
+    }
+    if (a.minor != b.minor) {
+        return a.minor < b.minor ? -1 : 1;
+    }
+    if (a.patch != b.patch) {
+        return a.patch < b.patch ? -1 : 1;
+    }
+    return comparePreRelease(a.preRelease, b.preRelease);
+}
+
+
 // ======================
 // 版本比较策略（策略模式）
 // ======================
@@ -14,12 +198,10 @@ public:
     virtual bool isNewer(const std::string& remote, const std::string& local) = 0;
 };
 
+// 按 SemVer 2.0 比较，任何一方不是合法版本号时返回false（不认为有更新），不抛异常
 class SemanticVersionComparator : public VersionComparator {
 public:
     bool isNewer(const std::string& remote, const std::string& local) override;
-
-private:
-    std::vector<int> splitVersion(const std::string& version);
 };
 
 class TimestampVersionComparator : public VersionComparator {